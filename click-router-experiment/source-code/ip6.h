@@ -181,5 +181,29 @@ uint16_t in6_cksum(const struct click_in6_addr *saddr,
 		   unsigned char *addr,
 		   uint16_t len2);
 
+/*
+ * Upper layer checksums summed with SIMD when the CPU has it (ip6cksum.cc).
+ * in6_cksum_add() adds len bytes at data to the partial sum sum; every buffer
+ * but the last must have an even length. in6_cksum_finish() adds the pseudo
+ * header, whose upper layer length len is in network byte order as in
+ * ip6_plen, and returns the checksum in network byte order, ready to store.
+ */
+uint64_t in6_cksum_add(const unsigned char *data, uint32_t len, uint64_t sum);
+
+uint16_t in6_cksum_finish(const struct click_in6_addr *saddr,
+			  const struct click_in6_addr *daddr,
+			  uint16_t len,
+			  uint8_t proto,
+			  uint64_t sum);
+
+/*Versions of in6_cksum_add(), checked against each other by IP6CksumTest*/
+enum{
+	IN6_CKSUM_VERSION_SCALAR, IN6_CKSUM_VERSION_SSE2, IN6_CKSUM_VERSION_AVX2, IN6_CKSUM_VERSION_COUNT
+};
+
+/*Same as in6_cksum_add() with the given version. Returns 0, leaving *sum
+ * alone, if this build or the CPU lacks that version*/
+int in6_cksum_add_version(int version, const unsigned char *data, uint32_t len, uint64_t *sum);
+
 CLICK_ENDDECLS
 #endif
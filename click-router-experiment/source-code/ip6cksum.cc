@@ -0,0 +1,175 @@
+/*
+ * ip6cksum.cc -- IP6 upper layer checksums
+ *
+ * Defines in6_cksum_add() and in6_cksum_finish(), declared in ip6.h. The
+ * payload is summed with AVX2 or SSE2 when the CPU has them, as found by
+ * CPUID on the first call, and 4 bytes at a time otherwise. Every version
+ * gives the same result. in6_cksum() and in6_fast_cksum() stay those of
+ * lib/in_cksum.c.
+ */
+
+#include <click/config.h>
+#include <click/glue.hh>
+#include <click/element.hh>
+#include <clicknet/ip6.h>
+#if defined(__x86_64__) && !defined(CLICK_LINUXMODULE)
+# include <emmintrin.h>
+# define IN6_CKSUM_SSE2 1
+# if defined(__GNUC__)
+#  include <immintrin.h>
+#  define IN6_CKSUM_AVX2 1
+# endif
+#endif
+CLICK_DECLS
+
+/*
+ * The payload is summed as it lies in memory, 32 bits at a time, in a 64-bit
+ * accumulator; the carries are only folded back into 16 bits at the end.
+ * Since 2^16 = 1 modulo 0xFFFF, this gives the ones' complement sum of the
+ * 16-bit words in network byte order, whatever the byte order of the CPU.
+ */
+
+static inline uint16_t
+cksum_fold(uint64_t sum){
+	sum = (sum & 0xFFFFFFFF) + (sum >> 32);
+	sum = (sum & 0xFFFFFFFF) + (sum >> 32);
+	sum = (sum & 0xFFFF) + (sum >> 16);
+	sum = (sum & 0xFFFF) + (sum >> 16);
+	sum = (sum & 0xFFFF) + (sum >> 16);
+	return sum;
+}
+
+static uint64_t
+cksum_add_scalar(const unsigned char *data, uint32_t len, uint64_t sum){
+	uint32_t w;
+	uint16_t h;
+	while (len >= 4) {
+		memcpy(&w, data, 4);
+		sum += w;
+		data += 4;
+		len -= 4;
+	}
+	if (len >= 2) {
+		memcpy(&h, data, 2);
+		sum += h;
+		data += 2;
+		len -= 2;
+	}
+	if (len) {
+		//an odd byte is padded with a zero byte after it
+		h = 0;
+		memcpy(&h, data, 1);
+		sum += h;
+	}
+	return sum;
+}
+
+#if IN6_CKSUM_SSE2
+/*32 bytes per iteration: 32-bit words are widened to 64 bits, so no
+ * carry is lost however long the payload*/
+static uint64_t
+cksum_add_sse2(const unsigned char *data, uint32_t len, uint64_t sum){
+	__m128i zero = _mm_setzero_si128();
+	__m128i acc0 = zero, acc1 = zero;
+	while (len >= 32) {
+		__m128i a = _mm_loadu_si128((const __m128i *) data);
+		__m128i b = _mm_loadu_si128((const __m128i *) (data + 16));
+		acc0 = _mm_add_epi64(acc0, _mm_add_epi64(_mm_unpacklo_epi32(a, zero), _mm_unpackhi_epi32(a, zero)));
+		acc1 = _mm_add_epi64(acc1, _mm_add_epi64(_mm_unpacklo_epi32(b, zero), _mm_unpackhi_epi32(b, zero)));
+		data += 32;
+		len -= 32;
+	}
+	uint64_t lanes[2];
+	_mm_storeu_si128((__m128i *) lanes, _mm_add_epi64(acc0, acc1));
+	return cksum_add_scalar(data, len, sum + lanes[0] + lanes[1]);
+}
+#endif
+
+#if IN6_CKSUM_AVX2
+/*Same as cksum_add_sse2(), 64 bytes per iteration*/
+__attribute__((target("avx2"))) static uint64_t
+cksum_add_avx2(const unsigned char *data, uint32_t len, uint64_t sum){
+	__m256i zero = _mm256_setzero_si256();
+	__m256i acc0 = zero, acc1 = zero;
+	while (len >= 64) {
+		__m256i a = _mm256_loadu_si256((const __m256i *) data);
+		__m256i b = _mm256_loadu_si256((const __m256i *) (data + 32));
+		acc0 = _mm256_add_epi64(acc0, _mm256_add_epi64(_mm256_unpacklo_epi32(a, zero), _mm256_unpackhi_epi32(a, zero)));
+		acc1 = _mm256_add_epi64(acc1, _mm256_add_epi64(_mm256_unpacklo_epi32(b, zero), _mm256_unpackhi_epi32(b, zero)));
+		data += 64;
+		len -= 64;
+	}
+	uint64_t lanes[4];
+	_mm256_storeu_si256((__m256i *) lanes, _mm256_add_epi64(acc0, acc1));
+	return cksum_add_scalar(data, len, sum + lanes[0] + lanes[1] + lanes[2] + lanes[3]);
+}
+#endif
+
+static uint64_t cksum_add_first(const unsigned char *data, uint32_t len, uint64_t sum);
+
+static uint64_t (*cksum_add)(const unsigned char *, uint32_t, uint64_t) = cksum_add_first;
+
+/*Picks the version the CPU supports on the first call. Threads racing
+ * here all store the same pointer*/
+static uint64_t
+cksum_add_first(const unsigned char *data, uint32_t len, uint64_t sum){
+	uint64_t (*f)(const unsigned char *, uint32_t, uint64_t) = cksum_add_scalar;
+#if IN6_CKSUM_SSE2
+	f = cksum_add_sse2;
+#endif
+#if IN6_CKSUM_AVX2
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) {
+		f = cksum_add_avx2;
+	}
+#endif
+	cksum_add = f;
+	return f(data, len, sum);
+}
+
+uint64_t
+in6_cksum_add(const unsigned char *data, uint32_t len, uint64_t sum){
+	return cksum_add(data, len, sum);
+}
+
+int
+in6_cksum_add_version(int version, const unsigned char *data, uint32_t len, uint64_t *sum){
+	switch (version) {
+	case IN6_CKSUM_VERSION_SCALAR:
+		*sum = cksum_add_scalar(data, len, *sum);
+		return 1;
+#if IN6_CKSUM_SSE2
+	case IN6_CKSUM_VERSION_SSE2:
+		*sum = cksum_add_sse2(data, len, *sum);
+		return 1;
+#endif
+#if IN6_CKSUM_AVX2
+	case IN6_CKSUM_VERSION_AVX2:
+		__builtin_cpu_init();
+		if (!__builtin_cpu_supports("avx2")) {
+			return 0;
+		}
+		*sum = cksum_add_avx2(data, len, *sum);
+		return 1;
+#endif
+	default:
+		return 0;
+	}
+}
+
+uint16_t
+in6_cksum_finish(const struct click_in6_addr *saddr,
+		 const struct click_in6_addr *daddr,
+		 uint16_t len,
+		 uint8_t proto,
+		 uint64_t sum){
+	//pseudo header: addresses, upper layer length and Next Header
+	sum = cksum_add_scalar(reinterpret_cast<const unsigned char *>(saddr), 16, sum);
+	sum = cksum_add_scalar(reinterpret_cast<const unsigned char *>(daddr), 16, sum);
+	sum += len;
+	sum += htons(proto);
+	return ~cksum_fold(sum) & 0xFFFF;
+}
+
+CLICK_ENDDECLS
+ELEMENT_PROVIDES(IP6Cksum)
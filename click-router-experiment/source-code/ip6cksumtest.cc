@@ -0,0 +1,132 @@
+/*
+ * ip6cksumtest.cc -- checks the versions of the IP6 upper layer checksum
+ */
+
+#include <click/config.h>
+#include "ip6cksumtest.hh"
+#include <clicknet/ip6.h>
+#include <click/args.hh>
+#include <click/error.hh>
+#include <click/glue.hh>
+#include <click/straccum.hh>
+CLICK_DECLS
+
+static const char * const version_names[IN6_CKSUM_VERSION_COUNT] = {
+	"scalar", "SSE2", "AVX2"
+};
+
+IP6CksumTest::IP6CksumTest()
+  : _max_length(65535)
+{
+}
+
+IP6CksumTest::~IP6CksumTest()
+{
+}
+
+int
+IP6CksumTest::configure(Vector<String> &conf, ErrorHandler *errh)
+{
+    if (Args(conf, this, errh)
+	.read_p("MAX_LENGTH", _max_length)
+	.complete() < 0)
+	return -1;
+    if (_max_length > 0xFFFF)
+	return errh->error("MAX_LENGTH must be at most 65535");
+    return 0;
+}
+
+/*Folds a sum of 16-bit words into 16 bits, with end-around carries*/
+static uint32_t
+fold(uint64_t sum)
+{
+	while (sum >> 16) {
+		sum = (sum & 0xFFFF) + (sum >> 16);
+	}
+	return sum;
+}
+
+/*
+ * Checks every length from 0 to _max_length of the data at data + alignment.
+ * The reference sum is kept byte by byte as the length grows, the versions
+ * sum each length from scratch.
+ */
+int
+IP6CksumTest::check(const unsigned char *data, int alignment, ErrorHandler *errh)
+{
+	const unsigned char *d = data + alignment;
+	click_in6_addr src, dst;
+	for (int i = 0; i < 16; i++) {
+		src.s6_addr[i] = 0x20 + i;
+		dst.s6_addr[i] = 0xF0 - i;
+	}
+	uint64_t pseudo = 17;
+	for (int i = 0; i < 16; i += 2) {
+		pseudo += (src.s6_addr[i] << 8) + src.s6_addr[i + 1];
+		pseudo += (dst.s6_addr[i] << 8) + dst.s6_addr[i + 1];
+	}
+
+	uint64_t reference = 0;
+	for (uint32_t len = 0; len <= _max_length; len++) {
+		if (len) {
+			//RFC 1071: the bytes form 16-bit words in network byte order
+			reference += ((len - 1) & 1 ? d[len - 1] : d[len - 1] << 8);
+		}
+		uint64_t sums[IN6_CKSUM_VERSION_COUNT];
+		for (int v = 0; v < IN6_CKSUM_VERSION_COUNT; v++) {
+			sums[v] = 0;
+			if (!in6_cksum_add_version(v, d, len, &sums[v])) {
+				continue;
+			}
+			if (sums[v] != sums[IN6_CKSUM_VERSION_SCALAR]) {
+				return errh->error("%s sum differs from scalar sum: length %u, alignment %d",
+					version_names[v], len, alignment);
+			}
+		}
+		uint16_t expected = htons(~fold(reference + pseudo + len) & 0xFFFF);
+		uint16_t got = in6_cksum_finish(&src, &dst, htons(len), 17, sums[IN6_CKSUM_VERSION_SCALAR]);
+		if (got != expected) {
+			return errh->error("checksum %04x, expected %04x: length %u, alignment %d",
+				ntohs(got), ntohs(expected), len, alignment);
+		}
+	}
+	return 0;
+}
+
+int
+IP6CksumTest::initialize(ErrorHandler *errh)
+{
+	//alignments are counted from a 64-byte boundary
+	unsigned char *memory = new unsigned char[_max_length + 128];
+	unsigned char *data = reinterpret_cast<unsigned char *>((reinterpret_cast<uintptr_t>(memory) + 63) & ~(uintptr_t) 63);
+	int r = 0;
+
+	for (uint32_t i = 0; i < _max_length + 64; i++) {
+		data[i] = click_random() & 0xFF;
+	}
+	for (int alignment = 0; alignment < 64 && r == 0; alignment++) {
+		r = check(data, alignment, errh);
+	}
+	memset(data, 0xFF, _max_length + 64);
+	for (int alignment = 0; alignment < 2 && r == 0; alignment++) {
+		r = check(data, alignment, errh);
+	}
+
+	StringAccum sa;
+	for (int v = 0; v < IN6_CKSUM_VERSION_COUNT; v++) {
+		uint64_t sum = 0;
+		if (in6_cksum_add_version(v, data, 0, &sum)) {
+			sa << (sa.length() ? ", " : "") << version_names[v];
+		}
+	}
+	delete[] memory;
+	if (r < 0) {
+		return r;
+	}
+	errh->message("All tests pass! (%s, lengths 0-%u, alignments 0-63)", sa.c_str(), _max_length);
+	return 0;
+}
+
+CLICK_ENDDECLS
+ELEMENT_REQUIRES(userlevel IP6Cksum)
+EXPORT_ELEMENT(IP6CksumTest)
@@ -1,5 +1,6 @@
 /*
- * IP6Classifier.{cc,hh} -- element classifies IP6 packets depending on its type (TCP, UDP, ICMP)
+ * IP6Classifier.{cc,hh} -- element classifies IP6 packets depending on its
+ * type (TCP, UDP, ICMP)
  * Hoang Trung Hieu
  *
  * Copyright (c) 1999-2000 Massachusetts Institute of Technology
@@ -19,428 +20,839 @@
 
 #include <click/config.h>
 #include "ip6classifier.hh"
+#include "ip6extparse.hh"
 #include <clicknet/ip6.h>
 #include <click/ip6address.hh>
 #include <click/glue.hh>
 #include <click/args.hh>
+#include <click/confparse.hh>
 #include <click/error.hh>
+#include <click/straccum.hh>
+#include <click/standard/scheduleinfo.hh>
+#if ADDRESS_TABLE_AVX2
+# include <immintrin.h>
+#endif
 #include <click/standard/alignmentinfo.hh>
 CLICK_DECLS
 
 IP6Classifier::IP6Classifier()
-  : _bad_src(0), _drops(0)
+  : _offset(0), _bad_src(0), _match_all(false), _cache_size(0),
+    _rules(0), _epoch(1), _readers(0), _nreaders(0), _reclaim_timer(this), _rules_version(0),
+    _task(this), _burst(32)
 {
 }
 
 IP6Classifier::~IP6Classifier() {
   delete[] _bad_src;
+  delete _rules;
+  for (int i = 0; i < _retired.size(); i++) {
+	  delete _retired[i].rules;
+  }
+  delete[] _readers;
 }
 
+filter_types::~filter_types(){
+	while (list != NULL) {
+		arguments *next = list->next_argument;
+		if (sub_sub_type == SUB_SUB_TYPE_HOST || sub_sub_type == SUB_SUB_TYPE_NET) {
+			delete list->current_argument.ip6address;
+		}
+		delete list;
+		list = next;
+	}
+}
+
+rule_set::~rule_set(){
+	while (root_filter != NULL) {
+		filter_types *next = root_filter->next_pattern;
+		delete root_filter;
+		root_filter = next;
+	}
+	delete tree;
+	delete[] caches;
+}
+
+/*Splits a pattern into words. Parentheses and a leading ! are words of their own*/
 Token*
 IP6Classifier::parseConfigurationString(String inputString) {
-	Token *rootNode, *nextNode;
-	String right_sub_string,left_sub_string;
-	right_sub_string = inputString;
-	if(right_sub_string.find_left(' ', 0) < 0){
-		rootNode = new Token(inputString);
-		rootNode->nextToken = NULL;
-	} else {
-		left_sub_string = right_sub_string.substring(0, right_sub_string.find_left(' ', 0));
-		rootNode = new Token(left_sub_string);
-		nextNode = rootNode;
-		right_sub_string = right_sub_string.substring(right_sub_string.find_left(' ', 0) + 1);
-		while(right_sub_string.find_left(' ', 0) >=0){
-			left_sub_string = right_sub_string.substring(0, right_sub_string.find_left(' ', 0));
-			nextNode->nextToken = new Token(left_sub_string);
-			nextNode = nextNode->nextToken;
-			right_sub_string = right_sub_string.substring(right_sub_string.find_left(' ', 0) + 1);
+	Token *rootNode = NULL;
+	Token **nextNode = &rootNode;
+	const char *s = inputString.begin(), *end = inputString.end();
+	while (s != end) {
+		if (isspace((unsigned char) *s)) {
+			s++;
+			continue;
+		}
+		const char *word = s;
+		if (*s == '(' || *s == ')' || *s == '!') {
+			s++;
+		} else {
+			while (s != end && !isspace((unsigned char) *s) && *s != '(' && *s != ')') {
+				s++;
+			}
 		}
-		nextNode->nextToken = new Token(right_sub_string);
+		*nextNode = new Token(inputString.substring(word, s));
+		nextNode = &(*nextNode)->nextToken;
 	}
-
 	return rootNode;
 }
 
 bool pattern(Token *, filter_types *);
+bool parse_expression(Token *, Vector<filter_types *> &, Vector<expr_pattern::op> &, ErrorHandler *);
 
+/*
+ * Records in d everything the patterns may test beyond the fixed IP6 header.
+ * The extension header chain is walked once per packet, by the first
+ * element that needs it, and read back from the annotations afterwards.
+ */
+void
+IP6Classifier::parse(Packet *p, parse_descriptor &d){
+	  ip6_ext_info info;
+	  int plen = p->length() - _offset;
+	  ip6_ext_get(p, _offset, info);
+
+	  d.ip = reinterpret_cast <const click_ip6 *>( p->data() + _offset);
+	  d.l4_proto = -1;
+	  d.l4_offset = -1;
+	  d.src_port = d.dst_port = 0;
+	  d.icmp_type = 0;
+	  d.fragmented = (info.frag != 0);
+	  d.frag_offset = 0;
+	  if (d.fragmented) {
+		  const click_ip6_header_ext *frag = reinterpret_cast <const click_ip6_header_ext *>( p->data() + _offset + info.frag);
+		  d.frag_offset = ntohs(frag->ip6_frag._frag_offset_flag) & 0xFFF8;	//offset in bytes
+	  }
+
+	  if (info.flags & ip6_ext_info::F_LATER_FRAGMENT) {
+		  //only the first fragment carries the upper layer header
+		  d.l4_proto = info.proto;
+		  return;
+	  }
+	  if (info.l4 == 0 || info.l4 + 8 > plen) {
+		  return;
+	  }
+	  const click_ip6_header_ext *header = reinterpret_cast <const click_ip6_header_ext *>( p->data() + _offset + info.l4);
+	  switch (info.proto) {
+	  case 6:	//TCP header
+	  case 17:	//UDP header
+		  d.l4_proto = info.proto;
+		  d.l4_offset = info.l4;
+		  d.src_port = ntohs(header->ip6_udp_header._src_port);
+		  d.dst_port = ntohs(header->ip6_udp_header._dst_port);
+		  break;
+	  case 58:	//ICMP header
+		  d.l4_proto = info.proto;
+		  d.l4_offset = info.l4;
+		  d.icmp_type = header->ip6_icmp_header._type;
+		  break;
+	  default:	//encapsulated packet, ESP, no next header or unknown extension
+		  break;
+	  }
+}
+
+/*
+ * Reads the field tested by node from the parsed packet d.
+ * Returns the leaf selected by its value, or -1 if no pattern names that value.
+ * If filter_leaf is set, only the ports found in both leaves are selected.
+ */
 int
-IP6Classifier::match_ip6_hdr_fields(filter_types *_filter, Packet *p){
-	const click_ip6 *ip = reinterpret_cast <const click_ip6 *>( p->data() + _offset);
-	uint32_t _ip6_un = htonl(ip->ip6_flow), _ip6_flow, _ip6_vers, _ip6_cos;
-	uint8_t _hlim = ip->ip6_hlim;
-	unsigned int _bit_mask;
-	switch(_filter->sub_type){
-		case SUB_TYPE_IP_VERS:
-			_ip6_vers = _ip6_un>>28;
-			if(_ip6_vers == _filter->list->current_argument.numeric_data){
-				return 1;
-			}else{
-				return -1;
-			}
-		case SUB_TYPE_IP_HLL:
-			if(_filter->list->current_argument.numeric_data == _hlim){
-				return 1;
-			}else{
-				return -1;
-			}
-		case SUB_TYPE_IP_COS:
-			_bit_mask = 0b00001111111100000000000000000000;
-			_ip6_cos = (_ip6_un&_bit_mask)>>20;
-			if(_ip6_cos == _filter->list->current_argument.numeric_data){
-				return 1;
-			}else{
-				return -1;
-			}
-			return 1;
-		case SUB_TYPE_IP_FLOW:
-			_bit_mask = 0b00000000000011111111111111111111;
-			_ip6_flow = (_ip6_un&_bit_mask);
-			if(_ip6_flow == _filter->list->current_argument.numeric_data){
-				return 1;
-			}else{
-				return -1;
-			}
-			return 1;
-		case SUB_TYPE_IP_FRAG:
-			return isFragmented(p);
-		case SUB_TYPE_IP_UNFRAG:
-			return -1*isFragmented(p);
-		default:
+IP6Classifier::lookup(const decision_node *node, const parse_descriptor &d, int &filter_leaf){
+	const click_ip6 *ip = d.ip;
+	uint32_t _ip6_un = ntohl(ip->ip6_flow);
+	const int *leaf;
+
+	switch (node->field) {
+	case FIELD_TRUE:
+		return node->default_leaf;
+	case FIELD_VERS:
+		return node->small_values.lookup(_ip6_un >> 28);
+	case FIELD_HLIM:
+		return node->small_values.lookup(ip->ip6_hlim);
+	case FIELD_COS:
+		return node->small_values.lookup((_ip6_un & IP6_CLASS_MASK) >> IP6_CLASS_SHIFT);
+	case FIELD_FLOW:
+		leaf = node->values.get_pointer(_ip6_un & IP6_FLOW_MASK);
+		return leaf ? *leaf : -1;
+	case FIELD_FRAG:
+		return node->small_values.lookup(d.fragmented ? 1 : 0);
+	case FIELD_PROTO:
+		if (d.l4_proto < 0) {
 			return -1;
+		}
+		return node->small_values.lookup(d.l4_proto);
+	case FIELD_SRC_HOST:
+		return node->addresses.lookup(ip->ip6_src);
+	case FIELD_DST_HOST:
+		return node->addresses.lookup(ip->ip6_dst);
+	case FIELD_SRC_AND_DST_HOST:
+		if (IP6Address(ip->ip6_src) != IP6Address(ip->ip6_dst)) {
+			return -1;
+		}
+		return node->addresses.lookup(ip->ip6_src);
+	case FIELD_SRC_NET:
+		return node->trie.lookup(ip->ip6_src);
+	case FIELD_DST_NET:
+		return node->trie.lookup(ip->ip6_dst);
+	case FIELD_SRC_AND_DST_NET:
+		filter_leaf = node->trie.lookup(ip->ip6_dst);
+		if (filter_leaf < 0) {
+			return -1;
+		}
+		return node->trie.lookup(ip->ip6_src);
+	case FIELD_SRC_PORT:
+	case FIELD_DST_PORT:
+	case FIELD_SRC_AND_DST_PORT:
+		if (((d.l4_proto != 6) && (d.l4_proto != 17)) || (d.l4_offset < 0)) {
+			return -1;
+		}
+		if (node->field == FIELD_DST_PORT) {
+			return node->ports[d.l4_proto == 17].lookup(d.dst_port);
+		} else if (node->field == FIELD_SRC_PORT || d.src_port == d.dst_port) {
+			return node->ports[d.l4_proto == 17].lookup(d.src_port);
+		} else {
+			return -1;
+		}
+	case FIELD_ICMP_TYPE:
+		if ((d.l4_proto != 58) || (d.l4_offset < 0)) {
+			return -1;
+		}
+		return node->small_values.lookup(d.icmp_type);
+	default:
+		return -1;
 	}
 }
 
+/*Returns the index of a leaf holding exactly ports, sharing identical leaves*/
 int
-IP6Classifier::isFragmented(Packet *p){
-	  const click_ip6 *ip = reinterpret_cast <const click_ip6 *>( p->data() + _offset);
-	  const click_ip6_header_ext *header;
-	  unsigned plen = p->length() - _offset;
-	  int pace = 40;
-	  uint8_t length;
-	  int cur_hdr_ext = ip->ip6_nxt;
-
-	  while(true) {
-		  header = reinterpret_cast <const click_ip6_header_ext *>( p->data() + _offset + pace);
-		  switch(cur_hdr_ext){
-		  case 6:	//TCP header
-			  click_chatter("Next header is TCP\n");
-			  return -1;
-		  case 17:	//UDP header
-			  click_chatter("Next header is UDP \n");
-			  return -1;
-		  case 58:	//ICMP header
-			  click_chatter("Next header is ICMP \n");
-			  return -1;
-		  case 0:	//Hop by Hop Header
-			  length = header->ip6_hdr_length;
-			  pace = pace + (length + 1) * 8;
-			  cur_hdr_ext = header->ip6_nxt_hdr;
-			  break;
-		  case 41:	//Encapsulating header
-			  break; //do nothing
-		  case 43:	//Routing Header
-			  length = header->ip6_hdr_length;
-			  pace = pace + (length + 1) * 8;
-			  cur_hdr_ext = header->ip6_nxt_hdr;
-			  break;
-		  case 44: 	//fragment header
-			  pace = pace + 8;		//Fragment header has fixed length of 8bytes
-			  cur_hdr_ext = header->ip6_nxt_hdr;
-			  //yes, this is fragmented packet. Return true
-			  return 1;
-		  case 50: 	//ESP
-			  length = header->ip6_hdr_length;
-			  pace = pace + (length + 2) * 4;	//Length of ESP is calculated in 4bytes block except the first 8bytes
-			  cur_hdr_ext = header->ip6_nxt_hdr;
-			  break;
-		  case 51: 	//Authentication header
-			  break;	//do nothing
-		  case 59:	//no header
-			  break; 	//do nothing
-		  case 60: 	//Destination header
-			  length = header->ip6_hdr_length;
-			  pace = pace + (length + 1) * 8;
-			  cur_hdr_ext = header->ip6_nxt_hdr;
-			  break;
-		  default:	//unknown IP6 header extension
-			  goto bad;
-		  }
-	  }
+decision_tree::add_leaf(const Vector<int> &ports){
+	if (ports.empty()) {
+		return -1;
+	}
+	StringAccum sa;
+	for (int i = 0; i < ports.size(); i++) {
+		sa << ports[i] << ' ';
+	}
+	String key = sa.take_string();
+	if (int *leaf = leaf_ids.get_pointer(key)) {
+		return *leaf;
+	}
+	leaves.push_back(ports);
+	leaf_ids.set(key, leaves.size() - 1);
+	return leaves.size() - 1;
+}
 
-	  bad:
-	 	 //click_chatter("Do not match in match_transport_protocols() \n");
-	 	 return -1;
+void
+value_map::init(int bits){
+	bitmap.assign(((1 << bits) + 63) / 64, 0);
+	rank.assign(bitmap.size(), 0);
+	leaves.clear();
 }
 
-int
-IP6Classifier::match_transport_protocols(filter_types *_filter, Packet *p){
-	  const click_ip6 *ip = reinterpret_cast <const click_ip6 *>( p->data() + _offset);
-	  const click_ip6_header_ext *header;
-	  unsigned plen = p->length() - _offset;
-	  uint16_t _src_port, _dst_port, t_port;
-	  uint8_t _icmp_type, _icmp_code;
-	  int pace = 40;
-	  uint8_t length;
-	  int cur_hdr_ext = ip->ip6_nxt;
-	  arguments *arg;
-	  while (true) {
-		  header = reinterpret_cast <const click_ip6_header_ext *>( p->data() + _offset + pace);
-		  switch (cur_hdr_ext) {
-		  case 6:	//TCP header
-			  click_chatter("Next header is TCP\n");
-			  if (_filter->sub_sub_type != SUB_SUB_TYPE_TCP) {
-				  return -1;
-			  } else {
-				  if (_filter->sub_type == SUB_TYPE_IP_PROTO) {
-					  return 1;
-				  }
-			  }
-			 _src_port = header->ip6_tcp_src_port;
-			 _dst_port = header->ip6_tcp_dst_port;
-			 _src_port = htons(_src_port);
-			 _dst_port = htons(_dst_port);
-			 goto good;
-		  case 17:	//UDP header
-			  click_chatter("Next header is UDP \n");
-			  if (_filter->sub_sub_type != SUB_SUB_TYPE_UDP) {
-				  return -1;
-			  } else {
-				  if (_filter->sub_type == SUB_TYPE_IP_PROTO) {
-				  		return 1;
-				  }
-			  }
-				 _src_port = header->ip6_udp_src_port;
-				 _dst_port = header->ip6_udp_dst_port;
-				 _src_port = htons(_src_port);
-				 _dst_port = htons(_dst_port);
-			  goto good;
-		  case 58:	//ICMP header
-			  click_chatter("Next header is ICMP \n");
-			  if (_filter->sub_sub_type != SUB_SUB_TYPE_ICMP) {
-				  return -1;
-			  } else {
-				  if (_filter->sub_type == SUB_TYPE_IP_PROTO) {
-				  		return 1;
-				  }
-			  }
-			  _icmp_type = header->ip6_icmp_type;
-			  goto good;
-
-		  case 0:	//Hop by Hop Header
-			  length = header->ip6_hdr_length;
-			  pace = pace + (length + 1) * 8;
-			  cur_hdr_ext = header->ip6_nxt_hdr;
-			  break;
-		  case 41:	//Encapsulating header
-			  break; //do nothing
-		  case 43:	//Routing Header
-			  length = header->ip6_hdr_length;
-			  pace = pace + (length + 1) * 8;
-			  cur_hdr_ext = header->ip6_nxt_hdr;
-			  break;
-		  case 44: 	//fragment header
-			  pace = pace + 8;		//Fragment header has fixed length of 8bytes
-			  cur_hdr_ext = header->ip6_nxt_hdr;
-			  break;
-		  case 50: 	//ESP
-			  length = header->ip6_hdr_length;
-			  pace = pace + (length + 2) * 4;	//Length of ESP is calculated in 4bytes block except the first 8bytes
-			  cur_hdr_ext = header->ip6_nxt_hdr;
-			  break;
-		  case 51: 	//Authentication header
-			  break;	//do nothing
-		  case 59:	//no header
-			  break; 	//do nothing
-		  case 60: 	//Destination header
-			  length = header->ip6_hdr_length;
-			  pace = pace + (length + 1) * 8;
-			  cur_hdr_ext = header->ip6_nxt_hdr;
-			  break;
-		  default:	//unknown IP6 header extension
-			  goto bad;
-		  }
-	  }
-	  p->set_ip6_header(ip);
-	  return -1;
-
-	 good:
-	 	 arg = _filter->list;
-	 	 while(arg != NULL){
-	 		 t_port = arg->current_argument.numeric_data;
-	 		 if (_filter->type == TYPE_ICMP) {
-	 			 if (t_port == _icmp_type) {
-	 				 return 1;
-	 			 }
-	 		 } else {
-				 switch (_filter->sub_type) {
-				 case SUB_TYPE_SRC:
-					 if (t_port == _src_port) {
-						 return 1;
-					 }
-					 break;
-				 case SUB_TYPE_DST:
-					 if (t_port == _dst_port) {
-						 return 1;
-					 }
-					 break;
-				 case SUB_TYPE_SRC_AND_DST:
-					 if ((t_port == _src_port)&&(t_port == _dst_port)) {
-						 return 1;
-					 }
-					 break;
-				 case SUB_TYPE_SRC_OR_DST:
-					 if ((t_port == _src_port)||(t_port == _dst_port)) {
-						 return 1;
-					 }
-					 break;
-				 case SUB_TYPE_IP_PROTO:
-					 break;
-				 default:
-					 click_chatter("Error in match_transport_protocols()");
-					 return -1;
-				 }
-	 		 }
-			 arg = arg->next_argument;
-	 	 }
-
-	bad:
-	 	 click_chatter("Do not match in match_transport_protocols() \n");
-	 	 return -1;
+void
+value_map::insert(uint32_t value){
+	bitmap[value >> 6] |= 1ULL << (value & 63);
 }
 
-inline bool
-IP6Classifier::compare_host_net(int option, IP6Address left, IP6Address *right){
-    uint32_t *ai = left.data32(), *bi = right->data32();
-    if (option == SUB_SUB_TYPE_HOST) {
-    	return ai[0] == bi[0] && ai[1] == bi[1] && ai[2] == bi[2] && ai[3] == bi[3];
-    } else if (option == SUB_SUB_TYPE_NET) {
-    	//check whether it is network address or not
-    	//one or more bits in the node part of ip6address are not 0
-    	if ((bi[2] != 0)||(bi[3] != 0)) {
-    		return false;
-    	}
-    	return ai[0] == bi[0] && ai[1] == bi[1];
-    } else {
-    	return false;
-    }
+void
+value_map::finish(){
+	uint32_t members = 0;
+	for (int i = 0; i < bitmap.size(); i++) {
+		rank[i] = members;
+		members += __builtin_popcountll(bitmap[i]);
+	}
+	leaves.assign(members, -1);
+}
 
+void
+value_map::set_leaf(uint32_t value, int leaf){
+	leaves[rank[value >> 6] + __builtin_popcountll(bitmap[value >> 6] & ((1ULL << (value & 63)) - 1))] = leaf;
 }
 
-int
-IP6Classifier::match_ip(filter_types *_filter, Packet *p){
-	const click_ip6 *ip = reinterpret_cast <const click_ip6 *>( p->data() + _offset);
-	IP6Address _src_addr;
-	IP6Address _dst_addr;
-	_src_addr = IP6Address(ip->ip6_src);
-	_dst_addr = IP6Address(ip->ip6_dst);
-	//mask address uses 64bits network mask
-	IP6Address _mask_addr = IP6Address("FF:FF:FF:FF:00:00:00:00");
-	arguments *arg = _filter->list;
-
-	if ((_filter->sub_sub_type == SUB_SUB_TYPE_TCP)||
-			(_filter->sub_sub_type == SUB_SUB_TYPE_UDP)) {
-		return match_transport_protocols(_filter, p);
-	}
-
-	while (arg != NULL) {
-		switch (_filter->sub_type) {
-			case SUB_TYPE_SRC:
-				if (compare_host_net(_filter->sub_sub_type, _src_addr, arg->current_argument.ip6address)) {
-					return 1;
-				} else {
-					return -1;
-				}
-			case SUB_TYPE_DST:
-				if (compare_host_net(_filter->sub_sub_type, _dst_addr, arg->current_argument.ip6address)) {
-					return 1;
-				} else {
-					return -1;
-				}
-			case SUB_TYPE_SRC_AND_DST:
-				if ((compare_host_net(_filter->sub_sub_type, _src_addr, arg->current_argument.ip6address))
-						&&(compare_host_net(_filter->sub_sub_type, _dst_addr, arg->current_argument.ip6address))) {
-					return 1;
-				} else {
-					return -1;
-				}
-			case SUB_TYPE_SRC_OR_DST:
-					if ((compare_host_net(_filter->sub_sub_type, _src_addr, arg->current_argument.ip6address))
-							||(compare_host_net(_filter->sub_sub_type, _dst_addr, arg->current_argument.ip6address))) {
-						return 1;
-					} else {
-						return -1;
-					}
-			default:
-				return -1;
+void
+address_table::init(int n){
+	int nbuckets = 1;
+	while (nbuckets * WAYS < 2 * n) {
+		nbuckets *= 2;
+	}
+	delete[] memory;
+	memory = new unsigned char[nbuckets * sizeof(bucket) + 63];
+	buckets = reinterpret_cast<bucket *>(((uintptr_t) memory + 63) & ~(uintptr_t) 63);
+	memset(buckets, 0, nbuckets * sizeof(bucket));
+	values.assign(nbuckets * WAYS, -1);
+	mask = nbuckets - 1;
+#if ADDRESS_TABLE_AVX2
+	__builtin_cpu_init();
+	avx2 = __builtin_cpu_supports("avx2");
+#endif
+}
+
+void
+address_table::insert(const click_in6_addr &addr, int value){
+	for (uint32_t i = hash(addr) & mask; ; i = (i + 1) & mask) {
+		for (int w = 0; w < WAYS; w++) {
+			int &v = values[i * WAYS + w];
+			if (v < 0 || memcmp(&buckets[i].addr[w], &addr, sizeof(addr)) == 0) {
+				buckets[i].addr[w] = addr;
+				v = value;
+				return;
+			}
 		}
-		arg = arg->next_argument;
 	}
 }
 
-int
-IP6Classifier::match_pattern(filter_types *_filter, Packet *p){
-	switch (_filter->type) {
-	case TYPE_DST:
-		if ((_filter->sub_sub_type == SUB_SUB_TYPE_TCP)||(_filter->sub_sub_type == SUB_SUB_TYPE_UDP)) {
-			return match_transport_protocols(_filter, p);
+#if ADDRESS_TABLE_AVX2
+/*Same as lookup(), comparing the key with two addresses per instruction*/
+__attribute__((target("avx2"))) int
+address_table::lookup_avx2(const click_in6_addr &addr) const{
+	__m256i key = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *) &addr));
+	for (uint32_t i = hash(addr) & mask; ; i = (i + 1) & mask) {
+		const __m256i *b = (const __m256i *) &buckets[i];
+		//one bit per 64-bit half; way w matches when bits 2w and 2w + 1 are set
+		uint32_t halves = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(_mm256_load_si256(b), key)))
+			| (_mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(_mm256_load_si256(b + 1), key))) << 4);
+		uint32_t ways = halves & (halves >> 1) & 0x55;
+		const int *v = &values[i * WAYS];
+		if (ways || v[WAYS - 1] < 0) {
+			int value = v[__builtin_ctz(ways | 1 << 2 * (WAYS - 1)) >> 1];
+			return ways ? value : -1;
+		}
+	}
+}
+#endif
+
+void
+flow_cache::init(int size){
+	int sets = 1;
+	while (sets * WAYS < size) {
+		sets *= 2;
+	}
+	entry empty;
+	memset(&empty, 0, sizeof(empty));
+	empty.nports = -1;
+	entries.assign(sets * WAYS, empty);
+	hands.assign(sets, 0);
+	mask = sets - 1;
+}
+
+void
+flow_cache::insert(const flow_key &key, uint32_t hash, const int *ports, int nports){
+	if (entries.empty()) {
+		return;
+	}
+	uint32_t set = hash & mask;
+	entry *ways = &entries[set * WAYS];
+	int way = 0;
+	while (way < WAYS && ways[way].nports >= 0) {
+		way++;
+	}
+	if (way == WAYS) {
+		//clock: give a second chance to the entries hit since the last pass
+		uint8_t &hand = hands[set];
+		while (ways[hand].referenced) {
+			ways[hand].referenced = 0;
+			hand = (hand + 1) % WAYS;
+		}
+		way = hand;
+		hand = (hand + 1) % WAYS;
+		evictions++;
+	}
+	entry &e = ways[way];
+	e.key = key;
+	e.nports = nports;
+	e.referenced = 0;
+	memcpy(e.ports, ports, nports * sizeof(int));
+}
+
+/*Bits [offset, offset + STRIDE) of the address held in hi:lo, zero padded*/
+static inline uint32_t
+trie_slot(uint64_t hi, uint64_t lo, int offset){
+	if (offset + prefix_trie::STRIDE <= 64) {
+		return (hi >> (64 - prefix_trie::STRIDE - offset)) & 63;
+	} else if (offset < 64) {
+		return ((hi << (offset + prefix_trie::STRIDE - 64)) | (lo >> (128 - prefix_trie::STRIDE - offset))) & 63;
+	} else if (offset + prefix_trie::STRIDE <= 128) {
+		return (lo >> (128 - prefix_trie::STRIDE - offset)) & 63;
+	} else {
+		return (lo << (offset + prefix_trie::STRIDE - 128)) & 63;
+	}
+}
+
+static inline void
+trie_split(const click_in6_addr &addr, uint64_t &hi, uint64_t &lo){
+	hi = ((uint64_t) ntohl(addr.s6_addr32[0]) << 32) | ntohl(addr.s6_addr32[1]);
+	lo = ((uint64_t) ntohl(addr.s6_addr32[2]) << 32) | ntohl(addr.s6_addr32[3]);
+}
+
+/*Adds port to the sorted list ports*/
+static void
+insert_port(Vector<int> &ports, int port){
+	int i = ports.size();
+	while (i > 0 && ports[i - 1] > port) {
+		i--;
+	}
+	if (i == 0 || ports[i - 1] != port) {
+		ports.insert(ports.begin() + i, port);
+	}
+}
+
+void
+prefix_trie::build(decision_tree *tree, const Vector<prefix_entry> &prefixes){
+	Vector<const prefix_entry *> entries;
+	Vector<int> inherited;
+	for (int i = 0; i < prefixes.size(); i++) {
+		if (prefixes[i].prefix_length == 0) {	//::/0 holds every address
+			insert_port(inherited, prefixes[i].output_port);
 		} else {
-			return match_ip(_filter, p);
-		}
-	case TYPE_ETHER:
-		break;
-	case TYPE_ICMP:
-		return match_transport_protocols(_filter, p);
-		break;
-	case TYPE_IP:
-		if (_filter->sub_type == SUB_TYPE_IP_PROTO) {
-			return match_transport_protocols(_filter, p);
+			entries.push_back(&prefixes[i]);
+		}
+	}
+	nodes.clear();
+	leaves.clear();
+	nodes.push_back(trie_node());
+	build_node(tree, 0, entries, 0, inherited);
+}
+
+/*
+ * Fills nodes[index], which stands for the addresses sharing their first
+ * offset bits. prefixes are the prefixes longer than offset below this node,
+ * inherited the ports of the shorter prefixes holding it.
+ */
+void
+prefix_trie::build_node(decision_tree *tree, int index, const Vector<const prefix_entry *> &prefixes,
+						int offset, const Vector<int> &inherited){
+	Vector<const prefix_entry *> deeper[64];
+	Vector<int> ports[64];
+	uint64_t hi, lo;
+
+	for (int v = 0; v < 64; v++) {
+		ports[v] = inherited;
+	}
+	for (int i = 0; i < prefixes.size(); i++) {
+		const prefix_entry *e = prefixes[i];
+		trie_split(e->addr.in6_addr(), hi, lo);
+		uint32_t v = trie_slot(hi, lo, offset);
+		if (e->prefix_length > offset + STRIDE) {
+			deeper[v].push_back(e);
 		} else {
-			return match_ip6_hdr_fields(_filter, p);
+			//a prefix ending inside this stride holds a range of slots
+			int span = 1 << (offset + STRIDE - e->prefix_length);
+			for (int w = v & ~(span - 1); w < (int) (v & ~(span - 1)) + span; w++) {
+				insert_port(ports[w], e->output_port);
+			}
 		}
-	case TYPE_SRC:
-		if ((_filter->sub_sub_type == SUB_SUB_TYPE_TCP)||(_filter->sub_sub_type == SUB_SUB_TYPE_UDP)) {
-			return match_transport_protocols(_filter, p);
+	}
+
+	trie_node n;
+	n.vector = n.leafvec = 0;
+	n.base0 = leaves.size();
+	n.base1 = nodes.size();
+	int last_leaf = -2;
+	for (int v = 0; v < 64; v++) {
+		if (!deeper[v].empty()) {
+			n.vector |= 1ULL << v;
+			nodes.push_back(trie_node());
 		} else {
-			return match_ip(_filter, p);
-		}
-	case TYPE_TCP:
-		return match_transport_protocols(_filter, p);
-	case TYPE_UDP:
-		return match_transport_protocols(_filter, p);
-	case TYPE_TRUE:		//match every packet
-		return 1;
-	case TYPE_FALSE:	//match no packet at all
-		return -1;
-	default:
-		break;
+			int leaf = tree->add_leaf(ports[v]);
+			if (leaf != last_leaf) {
+				n.leafvec |= 1ULL << v;
+				leaves.push_back(leaf);
+				last_leaf = leaf;
+			}
+		}
+	}
+	nodes[index] = n;
+
+	//children are allocated together so that they can be found by rank
+	int child = n.base1;
+	for (int v = 0; v < 64; v++) {
+		if (!deeper[v].empty()) {
+			build_node(tree, child++, deeper[v], offset + STRIDE, ports[v]);
+		}
 	}
-	return -1;
 }
 
-int
-IP6Classifier::configure(Vector<String> &conf, ErrorHandler *errh) {
-	Token* temp;
+/*Returns the leaf of the longest prefix holding addr, -1 if there is none*/
+inline int
+prefix_trie::lookup(const click_in6_addr &addr) const{
+	uint64_t hi, lo;
+	trie_split(addr, hi, lo);
+	const trie_node *n = &nodes[0];
+	int offset = 0;
+	uint32_t v = trie_slot(hi, lo, offset);
+	while (n->vector & (1ULL << v)) {
+		n = &nodes[n->base1 + __builtin_popcountll(n->vector & ((2ULL << v) - 1)) - 1];
+		offset += STRIDE;
+		v = trie_slot(hi, lo, offset);
+	}
+	return leaves[n->base0 + __builtin_popcountll(n->leafvec & ((2ULL << v) - 1)) - 1];
+}
+
+/*
+ * Compiles the list of patterns into a decision tree.
+ * Every pattern is split into (field, value) tests. Tests on the same field
+ * are merged into one node whose values point to the sorted list of output
+ * ports selecting that value. Patterns that cannot match are left out.
+ */
+decision_tree *
+IP6Classifier::compile(filter_types *root, ErrorHandler *errh){
+	//ports selected by each value of each field, before leaves are shared
+	HashTable<uint32_t, Vector<int> > values[FIELD_COUNT];
+	HashTable<IP6Address, Vector<int> > addresses[FIELD_COUNT];
+	Vector<prefix_entry> prefixes[FIELD_COUNT];
+	Vector<int> always;
+	int fields[3], nfields;
+	uint32_t proto = 0;
+
+	for (filter_types *f = root; f != NULL; f = f->next_pattern) {
+		int port = f->output_port;
+		nfields = 0;
+		switch (f->type) {
+		case TYPE_TRUE:
+			always.push_back(port);
+			continue;
+		case TYPE_IP:
+			switch (f->sub_type) {
+			case SUB_TYPE_IP_VERS:	fields[nfields++] = FIELD_VERS; break;
+			case SUB_TYPE_IP_HLL:	fields[nfields++] = FIELD_HLIM; break;
+			case SUB_TYPE_IP_COS:	fields[nfields++] = FIELD_COS; break;
+			case SUB_TYPE_IP_FLOW:	fields[nfields++] = FIELD_FLOW; break;
+			case SUB_TYPE_IP_FRAG:
+			case SUB_TYPE_IP_UNFRAG: {
+				Vector<int> &v = values[FIELD_FRAG][f->sub_type == SUB_TYPE_IP_FRAG ? 1 : 0];
+				v.push_back(port);
+				continue;
+			}
+			case SUB_TYPE_IP_PROTO: {
+				proto = (f->sub_sub_type == SUB_SUB_TYPE_TCP ? 6 :
+						 f->sub_sub_type == SUB_SUB_TYPE_UDP ? 17 : 58);
+				values[FIELD_PROTO][proto].push_back(port);
+				continue;
+			}
+			}
+			break;
+		case TYPE_ICMP:
+			fields[nfields++] = FIELD_ICMP_TYPE;
+			break;
+		case TYPE_SRC:
+		case TYPE_DST:
+			if ((f->sub_sub_type == SUB_SUB_TYPE_TCP)||(f->sub_sub_type == SUB_SUB_TYPE_UDP)) {
+				proto = (f->sub_sub_type == SUB_SUB_TYPE_TCP ? 6 : 17);
+				switch (f->sub_type) {
+				case SUB_TYPE_SRC: fields[nfields++] = FIELD_SRC_PORT; break;
+				case SUB_TYPE_DST: fields[nfields++] = FIELD_DST_PORT; break;
+				case SUB_TYPE_SRC_AND_DST: fields[nfields++] = FIELD_SRC_AND_DST_PORT; break;
+				case SUB_TYPE_SRC_OR_DST:
+					fields[nfields++] = FIELD_SRC_PORT;
+					fields[nfields++] = FIELD_DST_PORT;
+					break;
+				}
+			} else {
+				int base = (f->sub_sub_type == SUB_SUB_TYPE_HOST ? FIELD_SRC_HOST : FIELD_SRC_NET);
+				switch (f->sub_type) {
+				case SUB_TYPE_SRC: fields[nfields++] = base; break;
+				case SUB_TYPE_DST: fields[nfields++] = base + 1; break;
+				case SUB_TYPE_SRC_AND_DST: fields[nfields++] = base + 2; break;
+				case SUB_TYPE_SRC_OR_DST:
+					fields[nfields++] = base;
+					fields[nfields++] = base + 1;
+					break;
+				}
+			}
+			break;
+		default:	//false and ether patterns match no packet
+			break;
+		}
+
+		for (arguments *arg = f->list; arg != NULL; arg = arg->next_argument) {
+			for (int i = 0; i < nfields; i++) {
+				Vector<int> *v;
+				if (fields[i] >= FIELD_SRC_NET && fields[i] <= FIELD_SRC_AND_DST_NET) {
+					IP6Address *a = arg->current_argument.ip6address;
+					if ((*a & IP6Address::make_prefix(arg->prefix_length)) != *a) {
+						//host bits set in a network address: never matches
+						errh->warning("pattern %d: %s is not a /%d network address", port, a->unparse().c_str(), arg->prefix_length);
+						continue;
+					}
+					prefix_entry e;
+					e.addr = *a;
+					e.prefix_length = arg->prefix_length;
+					e.output_port = port;
+					prefixes[fields[i]].push_back(e);
+					continue;
+				} else if (fields[i] >= FIELD_SRC_HOST && fields[i] <= FIELD_SRC_AND_DST_HOST) {
+					v = &addresses[fields[i]][*arg->current_argument.ip6address];
+				} else if (fields[i] >= FIELD_SRC_PORT && fields[i] <= FIELD_SRC_AND_DST_PORT) {
+					//a range names every port it holds
+					for (uint32_t value = arg->current_argument.numeric_data;
+						 value <= arg->numeric_end && value <= 0xFFFF; value++) {
+						v = &values[fields[i]][(proto << 16) | value];
+						if (v->empty() || v->back() != port) {
+							v->push_back(port);
+						}
+					}
+					continue;
+				} else {
+					v = &values[fields[i]][arg->current_argument.numeric_data];
+				}
+				if (v->empty() || v->back() != port) {
+					v->push_back(port);
+				}
+			}
+		}
+	}
+
+	//build the nodes, sharing identical leaves
+	decision_tree *tree = new decision_tree;
+	if (!always.empty()) {
+		decision_node *node = new decision_node(FIELD_TRUE);
+		node->default_leaf = tree->add_leaf(always);
+		tree->nodes.push_back(node);
+	}
+	for (int field = FIELD_TRUE + 1; field < FIELD_COUNT; field++) {
+		if (values[field].empty() && addresses[field].empty() && prefixes[field].empty()) {
+			continue;
+		}
+		decision_node *node = new decision_node(field);
+		if (field == FIELD_VERS || field == FIELD_HLIM || field == FIELD_COS || field == FIELD_FRAG) {
+			tree->key_fields_only = false;
+		}
+		if (field == FIELD_FLOW) {
+			for (HashTable<uint32_t, Vector<int> >::const_iterator it = values[field].begin(); it.live(); it++) {
+				node->values.set(it.key(), tree->add_leaf(it.value()));
+			}
+		} else if (!values[field].empty()) {
+			//ports are keyed by (protocol << 16) | port, the other fields hold 8 bits
+			bool port_field = (field >= FIELD_SRC_PORT && field <= FIELD_SRC_AND_DST_PORT);
+			value_map *maps = (port_field ? node->ports : &node->small_values);
+			for (int i = 0; i < (port_field ? 2 : 1); i++) {
+				maps[i].init(port_field ? 16 : 8);
+			}
+			HashTable<uint32_t, Vector<int> >::const_iterator it;
+			for (it = values[field].begin(); it.live(); it++) {
+				if (port_field) {
+					maps[(it.key() >> 16) == 17].insert(it.key() & 0xFFFF);
+				} else if (it.key() < 256) {
+					maps[0].insert(it.key());
+				}
+			}
+			for (int i = 0; i < (port_field ? 2 : 1); i++) {
+				maps[i].finish();
+			}
+			for (it = values[field].begin(); it.live(); it++) {
+				if (port_field) {
+					maps[(it.key() >> 16) == 17].set_leaf(it.key() & 0xFFFF, tree->add_leaf(it.value()));
+				} else if (it.key() < 256) {
+					maps[0].set_leaf(it.key(), tree->add_leaf(it.value()));
+				}
+			}
+		}
+		if (!addresses[field].empty()) {
+			node->addresses.init(addresses[field].size());
+			for (HashTable<IP6Address, Vector<int> >::const_iterator it = addresses[field].begin(); it.live(); it++) {
+				node->addresses.insert(it.key().in6_addr(), tree->add_leaf(it.value()));
+			}
+		}
+		if (!prefixes[field].empty()) {
+			node->trie.build(tree, prefixes[field]);
+		}
+		tree->nodes.push_back(node);
+	}
+	tree->leaf_ids.clear();
+	return tree;
+}
+
+/*Parses and compiles a list of patterns. Returns NULL on syntax errors*/
+rule_set *
+IP6Classifier::build_rules(const Vector<String> &conf, ErrorHandler *errh){
+	rule_set *rules = new rule_set;
+	filter_types **next = &rules->root_filter;
+	Vector<filter_types *> tests;		//tests of the patterns combining several
 	int _out_port = 0;
-	ArgContext argcontext;
-	filter_types *temp_filter;
-	root_filter = new filter_types;
-	temp_filter = root_filter;
-	for (Vector<String>::iterator i=conf.begin(); i!=conf.end(); i++ ) {
+
+	for (Vector<String>::const_iterator i = conf.begin(); i != conf.end(); i++) {
 		//check syntax error and get the stream of tokens
-		temp = parseConfigurationString(*i);
-		if (_out_port != 0) {	//if this is not the first pattern;
-			temp_filter->next_pattern = new filter_types;
-			temp_filter = temp_filter->next_pattern;
+		Token *tokens = parseConfigurationString(*i);
+		Vector<expr_pattern::op> program;
+		PrefixErrorHandler perrh(errh, "pattern " + String(_out_port) + ": ");
+		bool parsed = parse_expression(tokens, tests, program, &perrh);
+		while (tokens != NULL) {
+			Token *t = tokens->nextToken;
+			delete tokens;
+			tokens = t;
 		}
-		if (pattern(temp, temp_filter) == true) {
+		if (parsed && program.size() == 1) {
+			//a single test is matched as a plain pattern
+			filter_types *temp_filter = tests.back();
+			tests.pop_back();
 			temp_filter->output_port = _out_port;
-		} else {
-			click_chatter("Syntax error in configure() \n");
-			return -1;
+			*next = temp_filter;
+			next = &temp_filter->next_pattern;
+		} else if (parsed) {
+			int depth = 0, max_depth = 0;
+			for (int j = 0; j < program.size(); j++) {
+				if (program[j].code == expr_pattern::OP_TEST) {
+					max_depth = (++depth > max_depth ? depth : max_depth);
+				} else if (program[j].code != expr_pattern::OP_NOT) {
+					depth--;
+				}
+			}
+			if (max_depth > expr_pattern::STACK_MAX) {
+				perrh.error("too deeply nested");
+				parsed = false;
+			} else {
+				expr_pattern e;
+				e.output_port = _out_port;
+				e.program = program;
+				rules->exprs.push_back(e);
+			}
 		}
+		if (!parsed) {
+			for (int j = 0; j < tests.size(); j++) {
+				delete tests[j];
+			}
+			delete rules;
+			return NULL;
+		}
+		rules->patterns.push_back(*i);
 		_out_port++;
 	}
-	temp_filter->next_pattern = NULL;
+	rules->npatterns = _out_port;
+
+	//tests get the ports after the patterns', so that leaves stay sorted
+	if (!rules->exprs.empty() && _out_port + tests.size() > rule_set::PORTS_MAX) {
+		errh->error("more than %d patterns and tests", (int) rule_set::PORTS_MAX);
+		for (int j = 0; j < tests.size(); j++) {
+			delete tests[j];
+		}
+		delete rules;
+		return NULL;
+	}
+	for (int j = 0; j < tests.size(); j++) {
+		tests[j]->output_port = _out_port + j;
+		*next = tests[j];
+		next = &tests[j]->next_pattern;
+	}
+	for (int j = 0; j < rules->exprs.size(); j++) {
+		Vector<expr_pattern::op> &program = rules->exprs[j].program;
+		for (int k = 0; k < program.size(); k++) {
+			program[k].test += _out_port;
+		}
+	}
+	if (!rules->root_filter) {
+		rules->root_filter = new filter_types;
+	}
+	rules->tree = compile(rules->root_filter, errh);
+
+	//cached results are only valid for the patterns they were computed with
+	if (_cache_size > 0) {
+		if (rules->tree->key_fields_only) {
+			rules->ncaches = click_max_cpu_ids();
+			rules->caches = new flow_cache[rules->ncaches];
+			for (int i = 0; i < rules->ncaches; i++) {
+				rules->caches[i].init(_cache_size);
+			}
+			rules->use_cache = true;
+		} else {
+			errh->warning("CACHE ignored: patterns test header fields outside the flow key");
+		}
+	}
+	return rules;
+}
+
+/*
+ * Makes rules the rules in use. The replaced set is retired, and freed by
+ * reclaim() once every thread that could have read it has left the element.
+ */
+void
+IP6Classifier::publish(rule_set *rules){
+	rule_set *old = __atomic_exchange_n(&_rules, rules, __ATOMIC_SEQ_CST);
+	//a thread entering from now on announces an epoch >= e, and reads rules
+	uint64_t e = __atomic_add_fetch(&_epoch, 1, __ATOMIC_SEQ_CST);
+	retired_rules r;
+	r.rules = old;
+	r.epoch = e;
+	_retired_lock.acquire();
+	_retired.push_back(r);
+	_retired_lock.release();
+	reclaim();
+}
+
+/*Frees the retired rule sets no thread can still be reading*/
+void
+IP6Classifier::reclaim(){
+	uint64_t oldest = ~(uint64_t) 0;
+	for (unsigned i = 0; i < _nreaders; i++) {
+		uint64_t e = __atomic_load_n(&_readers[i].epoch, __ATOMIC_ACQUIRE);
+		if (e != 0 && e < oldest) {
+			oldest = e;
+		}
+	}
+	Vector<rule_set *> freed;
+	_retired_lock.acquire();
+	for (int i = 0; i < _retired.size(); ) {
+		if (_retired[i].epoch <= oldest) {
+			freed.push_back(_retired[i].rules);
+			_retired[i] = _retired.back();
+			_retired.pop_back();
+		} else {
+			i++;
+		}
+	}
+	bool pending = !_retired.empty();
+	_retired_lock.release();
+	for (int i = 0; i < freed.size(); i++) {
+		delete freed[i];
+	}
+	if (pending && _reclaim_timer.initialized() && !_reclaim_timer.scheduled()) {
+		_reclaim_timer.schedule_after_msec(1);
+	}
+}
+
+void
+IP6Classifier::run_timer(Timer *){
+	reclaim();
+}
+
+int
+IP6Classifier::configure(Vector<String> &conf, ErrorHandler *errh) {
+	String match = "first";
+	uint32_t cache_size = 0;
+	int burst = 32;
+
+	if (_trace.configure(conf, this, errh) < 0)
+		return -1;
+	_stats.configure(noutputs());
+	if (Args(this, errh).bind(conf)
+		.read("MATCH", WordArg(), match)
+		.read("CACHE", cache_size)
+		.read("BURST", burst)
+		.consume() < 0)
+		return -1;
+	if (burst < 1 || burst > BURST_MAX) {
+		return errh->error("BURST must be between 1 and %d", (int) BURST_MAX);
+	}
+	_burst = burst;
+	if (match == "first") {
+		_match_all = false;
+	} else if (match == "all") {
+		_match_all = true;
+	} else {
+		return errh->error("MATCH must be first or all");
+	}
+
+	_cache_size = cache_size;
+	rule_set *rules = build_rules(conf, errh);
+	if (!rules) {
+		return -1;
+	}
+	//no packet is classified while the router is being configured
+	delete _rules;
+	_rules = rules;
+	if (!_readers) {
+		_nreaders = click_max_cpu_ids();
+		_readers = new reader[_nreaders];
+		memset(_readers, 0, _nreaders * sizeof(reader));
+	}
 /*
  String badaddrs = String::make_empty();
  _offset = 0;
@@ -481,37 +893,438 @@ IP6Classifier::configure(Vector<String> &conf, ErrorHandler *errh) {
   return 0;
 }
 
+/*Position in one leaf while merging the leaves selected by a packet*/
+struct IP6Classifier::leaf_cursor{
+	const Vector<int> *ports;
+	const Vector<int> *filter;	//if not NULL, only ports also listed here are selected
+	int pos;
+	int filter_pos;
+
+	//Returns the next selected port, -1 at the end of the leaf
+	inline int current(){
+		for (; pos < ports->size(); pos++) {
+			int port = (*ports)[pos];
+			if (filter == NULL) {
+				return port;
+			}
+			while (filter_pos < filter->size() && (*filter)[filter_pos] < port) {
+				filter_pos++;
+			}
+			if (filter_pos < filter->size() && (*filter)[filter_pos] == port) {
+				return port;
+			}
+		}
+		return -1;
+	}
+};
+
+/*Sends p to the given sorted ports, or handles it as unmatched if there are none*/
+void
+IP6Classifier::push_matches(Packet *p, int npatterns, const int *ports, int nports){
+  if (nports == 0) {
+	  //unmatched packets go to the output after the patterns', if any
+	  if (unlikely(_trace.enabled()) && npatterns >= noutputs())
+		  _trace.record(IP6TRACE_NO_MATCH_DROP, p->length());
+	  _stats.emit(this, npatterns, p, IP6DROP_NO_MATCH);
+	  return;
+  }
+  for (int i = 0; i < nports - 1; i++) {
+	  if (Packet *q = p->clone()) {
+		  _stats.emit(this, ports[i], q, IP6DROP_NO_OUTPUT);
+	  } else {
+		  _stats.drop(IP6DROP_NO_MEMORY);
+	  }
+  }
+  _stats.emit(this, ports[nports - 1], p, IP6DROP_NO_OUTPUT);
+}
+
+/*Fills the flow cache key of a parsed packet. Returns false for fragments
+ * without the upper layer header, which cannot be told apart by their key*/
+inline bool
+IP6Classifier::make_key(const parse_descriptor &d, flow_key &key, uint32_t &hash){
+	if (d.l4_proto >= 0 && d.l4_offset < 0) {
+		return false;
+	}
+	const click_ip6 *ip = d.ip;
+	key.src = ip->ip6_src;
+	key.dst = ip->ip6_dst;
+	key.flow = ntohl(ip->ip6_flow) & IP6_FLOW_MASK;
+	key.src_port = d.src_port;
+	key.dst_port = (d.l4_proto == 58 ? d.icmp_type : d.dst_port);
+	key.proto = d.l4_proto;
+	key.padding = 0;
+	hash = flow_cache::hash(key);
+	return true;
+}
+
+/*Looks the packet up in every node of the decision tree and returns the number of leaves hit*/
+inline int
+IP6Classifier::lookup_nodes(const decision_tree *tree, const parse_descriptor &d, leaf_cursor *hits){
+	int nhits = 0;
+	for (int i = 0; i < tree->nodes.size(); i++) {
+		int filter_leaf = -1;
+		int leaf = lookup(tree->nodes[i], d, filter_leaf);
+		if (leaf >= 0) {
+			hits[nhits].ports = &tree->leaves[leaf];
+			hits[nhits].filter = (filter_leaf >= 0 ? &tree->leaves[filter_leaf] : NULL);
+			hits[nhits].pos = hits[nhits].filter_pos = 0;
+			nhits++;
+		}
+	}
+	return nhits;
+}
+
+/*Sets in bits the patterns and tests the packet matches, when some
+ * pattern combines tests: one lookup per node finds every test passed, then
+ * the combined patterns are evaluated from those*/
+void
+IP6Classifier::match_exprs(const rule_set *rules, const parse_descriptor &d, uint64_t *bits){
+	leaf_cursor hits[FIELD_COUNT];
+	memset(bits, 0, rule_set::PORT_WORDS * sizeof(uint64_t));
+	int nhits = lookup_nodes(rules->tree, d, hits);
+	for (int i = 0; i < nhits; i++) {
+		for (int port = hits[i].current(); port >= 0; hits[i].pos++, port = hits[i].current()) {
+			bits[port >> 6] |= 1ULL << (port & 63);
+		}
+	}
+	for (int i = 0; i < rules->exprs.size(); i++) {
+		const expr_pattern &e = rules->exprs[i];
+		if (e.matches(bits)) {
+			bits[e.output_port >> 6] |= 1ULL << (e.output_port & 63);
+		}
+	}
+}
+
+/*Returns the output of the first pattern matching the packet, -1 if none does.
+ * key is the packet's flow cache key, NULL if the cache is not used*/
+int
+IP6Classifier::first_match(rule_set *rules, const parse_descriptor &d, const flow_key *key, uint32_t hash){
+	leaf_cursor hits[FIELD_COUNT];
+	int port = -1;
+	flow_cache *cache = (key ? &rules->cache() : NULL);
+
+	if (cache) {
+		if (flow_cache::entry *e = cache->lookup(*key, hash)) {
+			cache->hits++;
+			port = e->nports ? e->ports[0] : -1;
+			goto done;
+		}
+		cache->misses++;
+	}
+	if (!rules->exprs.empty()) {
+		uint64_t bits[rule_set::PORT_WORDS];
+		match_exprs(rules, d, bits);
+		for (int w = 0; w * 64 < rules->npatterns; w++) {
+			if (bits[w]) {
+				port = w * 64 + __builtin_ctzll(bits[w]);
+				break;
+			}
+		}
+		if (port >= rules->npatterns) {		//only tests matched
+			port = -1;
+		}
+	} else {
+		//leaves are sorted, so the first port of each leaf is its lowest
+		int nhits = lookup_nodes(rules->tree, d, hits);
+		for (int i = 0; i < nhits; i++) {
+			int next = hits[i].current();
+			if ((next >= 0) && ((port < 0) || (next < port))) {
+				port = next;
+			}
+		}
+	}
+	if (cache) {
+		cache->insert(*key, hash, &port, port >= 0 ? 1 : 0);
+	}
+
+  done:
+	if (unlikely(_trace.enabled()) && port < 0)
+		_trace.record(IP6TRACE_NO_MATCH, d.l4_proto >= 0 ? d.l4_proto : 255);
+	return port;
+}
+
+/*Sends p to the output of every pattern it matches, cloned for every output
+ * but the last, which gets the original*/
+void
+IP6Classifier::push_all_matches(rule_set *rules, Packet *p, const parse_descriptor &d, const flow_key *key, uint32_t hash){
+	leaf_cursor hits[FIELD_COUNT];
+	flow_cache *cache = (key ? &rules->cache() : NULL);
+
+	if (cache) {
+		if (flow_cache::entry *e = cache->lookup(*key, hash)) {
+			cache->hits++;
+			if (unlikely(_trace.enabled()) && e->nports == 0)
+				_trace.record(IP6TRACE_NO_MATCH, d.l4_proto >= 0 ? d.l4_proto : 255);
+			push_matches(p, rules->npatterns, e->ports, e->nports);
+			return;
+		}
+		cache->misses++;
+	}
+
+	if (!rules->exprs.empty()) {
+		uint64_t bits[rule_set::PORT_WORDS];
+		int ports[rule_set::PORTS_MAX];
+		int nports = 0;
+		match_exprs(rules, d, bits);
+		for (int w = 0; w * 64 < rules->npatterns; w++) {
+			for (uint64_t b = bits[w]; b; b &= b - 1) {
+				int port = w * 64 + __builtin_ctzll(b);
+				if (port < rules->npatterns) {
+					ports[nports++] = port;
+				}
+			}
+		}
+		if (cache && nports <= flow_cache::MAX_PORTS) {
+			cache->insert(*key, hash, ports, nports);
+		}
+		if (unlikely(_trace.enabled()) && nports == 0)
+			_trace.record(IP6TRACE_NO_MATCH, d.l4_proto >= 0 ? d.l4_proto : 255);
+		push_matches(p, rules->npatterns, ports, nports);
+		return;
+	}
+
+	//leaves are sorted, so merging them visits the ports in pattern order
+	int nhits = lookup_nodes(rules->tree, d, hits);
+	int matched[flow_cache::MAX_PORTS];
+	int nmatched = 0;
+	int last = -1;
+	while (true) {
+		int port = -1;
+		for (int i = 0; i < nhits; i++) {
+			int next = hits[i].current();
+			if ((next >= 0) && ((port < 0) || (next < port))) {
+				port = next;
+			}
+		}
+		if (port < 0) {
+			break;
+		}
+		for (int i = 0; i < nhits; i++) {
+			if (hits[i].current() == port) {
+				hits[i].pos++;
+			}
+		}
+		if (nmatched < flow_cache::MAX_PORTS) {
+			matched[nmatched] = port;
+		}
+		nmatched++;
+		if (last >= 0) {
+			if (Packet *q = p->clone()) {
+				_stats.emit(this, last, q, IP6DROP_NO_OUTPUT);
+			} else {
+				_stats.drop(IP6DROP_NO_MEMORY);
+			}
+		}
+		last = port;
+	}
+
+	if (cache && nmatched <= flow_cache::MAX_PORTS) {
+		cache->insert(*key, hash, matched, nmatched);
+	}
+	if (last >= 0) {
+		_stats.emit(this, last, p, IP6DROP_NO_OUTPUT);
+	} else {
+		if (unlikely(_trace.enabled()))
+			_trace.record(IP6TRACE_NO_MATCH, d.l4_proto >= 0 ? d.l4_proto : 255);
+		push_matches(p, rules->npatterns, matched, 0);
+	}
+}
+
 void
 IP6Classifier::push(int, Packet *p){
-  filter_types *temp_filter = root_filter;
-  Packet *temp_packet;
-  /*in case some packets sastify more than one patterns,
-   * packet p should be cloned and passed to more than one output ports
-   * If packet p is not cloned, segmentation error will occurs*/
-  while (temp_filter != NULL) {
-	  if (match_pattern(temp_filter, p)>0) {
-		  temp_packet = p->clone();
-		  checked_output_push(temp_filter->output_port, temp_packet);
-		  //p->kill;
+  parse_descriptor d;
+  flow_key key;
+  uint32_t hash = 0;
+
+  //walk the extension header chain once
+  _stats.profile_start();
+  reader &r = current_reader();
+  rule_set *rules = enter(r);
+  parse(p, d);
+  const flow_key *k = (rules->use_cache && make_key(d, key, hash) ? &key : NULL);
+
+  /*In first-match mode the packet leaves, uncloned, on the lowest matching
+   * port. In all-match mode it is cloned for every matching port but the last*/
+  if (_match_all) {
+	  push_all_matches(rules, p, d, k, hash);
+  } else {
+	  int port = first_match(rules, d, k, hash);
+	  push_matches(p, rules->npatterns, &port, port >= 0 ? 1 : 0);
+  }
+  leave(r);
+}
+
+/*
+ * Classifies n packets at once. Each stage runs over the whole batch, so the
+ * memory accesses of one packet overlap with the work on the others: packet
+ * headers are prefetched before any is parsed, and flow cache sets before
+ * any is searched. In first-match mode the packets then leave grouped by
+ * output, in arrival order within each output.
+ */
+void
+IP6Classifier::push_batch(Packet **packets, int n){
+  parse_descriptor d[BURST_MAX];
+  flow_key keys[BURST_MAX];
+  uint32_t hashes[BURST_MAX];
+  bool keyed[BURST_MAX];
+  int ports[BURST_MAX];
+  _stats.profile_start();
+  reader &r = current_reader();
+  rule_set *rules = enter(r);
+  flow_cache *cache = (rules->use_cache ? &rules->cache() : NULL);
+
+  //the IP6 header and, most often, the upper layer header that follows it
+  for (int i = 0; i < n; i++) {
+	  const unsigned char *data = packets[i]->data() + _offset;
+	  __builtin_prefetch(data);
+	  __builtin_prefetch(data + 64);
+  }
+  for (int i = 0; i < n; i++) {
+	  parse(packets[i], d[i]);
+	  keyed[i] = (cache && make_key(d[i], keys[i], hashes[i]));
+	  if (keyed[i]) {
+		  cache->prefetch(hashes[i]);
 	  }
-	  temp_filter = temp_filter->next_pattern;
   }
+
+  if (_match_all) {
+	  for (int i = 0; i < n; i++) {
+		  push_all_matches(rules, packets[i], d[i], keyed[i] ? &keys[i] : NULL, hashes[i]);
+	  }
+	  leave(r);
+	  return;
+  }
+
+  for (int i = 0; i < n; i++) {
+	  ports[i] = first_match(rules, d[i], keyed[i] ? &keys[i] : NULL, hashes[i]);
+  }
+  for (int i = 0; i < n; i++) {
+	  if (ports[i] == SENT) {
+		  continue;
+	  }
+	  int port = ports[i];
+	  for (int j = i; j < n; j++) {
+		  if (ports[j] == port) {
+			  push_matches(packets[j], rules->npatterns, &port, port >= 0 ? 1 : 0);
+			  ports[j] = SENT;
+		  }
+	  }
+  }
+  leave(r);
+}
+
+int
+IP6Classifier::initialize(ErrorHandler *errh){
+  _reclaim_timer.initialize(this);
+  if (input_is_pull(0)) {
+	  ScheduleInfo::initialize_task(this, &_task, errh);
+	  _signal = Notifier::upstream_empty_signal(this, 0, &_task);
+  }
+  return 0;
+}
+
+/*Pull input: classifies up to BURST packets per run*/
+bool
+IP6Classifier::run_task(Task *){
+  Packet *packets[BURST_MAX];
+  int n = 0;
+  while (n < _burst) {
+	  Packet *p = input(0).pull();
+	  if (!p) {
+		  break;
+	  }
+	  packets[n++] = p;
+  }
+  if (n > 0) {
+	  push_batch(packets, n);
+  }
+  if (n > 0 || _signal) {
+	  _task.fast_reschedule();
+  }
+  return n > 0;
 }
 
-static String
-IP6Classifier_read_drops(Element *xf, void *)
+enum { H_CACHE_HITS, H_CACHE_MISSES, H_CACHE_EVICTIONS, H_RULES, H_RULES_VERSION, H_PUBLISH_LATENCY };
+
+String
+IP6Classifier::read_handler(Element *e, void *thunk)
 {
-  IP6Classifier *f = (IP6Classifier *)xf;
-  return String(f->drops());
+  IP6Classifier *f = (IP6Classifier *)e;
+  switch ((intptr_t) thunk) {
+  case H_RULES_VERSION:
+    return String(f->_rules_version);
+  case H_PUBLISH_LATENCY:
+    return f->_publish_latency.unparse();
+  default:
+    break;
+  }
+
+  //the rules may be replaced by a concurrent write
+  reader &r = f->current_reader();
+  rule_set *rules = f->enter(r);
+  String s;
+  switch ((intptr_t) thunk) {
+  case H_CACHE_HITS:
+    s = String(rules->cache_count(&flow_cache::hits));
+    break;
+  case H_CACHE_MISSES:
+    s = String(rules->cache_count(&flow_cache::misses));
+    break;
+  case H_CACHE_EVICTIONS:
+    s = String(rules->cache_count(&flow_cache::evictions));
+    break;
+  case H_RULES: {
+    StringAccum sa;
+    for (int i = 0; i < rules->patterns.size(); i++) {
+      sa << rules->patterns[i] << '\n';
+    }
+    s = sa.take_string();
+    break;
+  }
+  }
+  f->leave(r);
+  return s;
+}
+
+/*Compiles the written patterns while the old ones keep classifying, then swaps them in*/
+int
+IP6Classifier::write_rules(const String &s, Element *e, void *, ErrorHandler *errh)
+{
+  IP6Classifier *f = (IP6Classifier *)e;
+  Timestamp start = Timestamp::now_steady();
+  Vector<String> conf;
+  //scripts pass the list quoted, since their own arguments are comma-separated
+  cp_argvec(cp_unquote(s), conf);
+  rule_set *rules = f->build_rules(conf, errh);
+  if (!rules) {
+    return -1;
+  }
+  if (rules->npatterns > f->noutputs()) {
+    delete rules;
+    return errh->error("%d patterns but only %d outputs", conf.size(), f->noutputs());
+  }
+  f->publish(rules);
+  f->_publish_latency = Timestamp::now_steady() - start;
+  f->_rules_version++;
+  return 0;
 }
 
 void
 IP6Classifier::add_handlers()
 {
-  add_read_handler("drops", IP6Classifier_read_drops);
+  add_read_handler("cache_hits", read_handler, H_CACHE_HITS);
+  add_read_handler("cache_misses", read_handler, H_CACHE_MISSES);
+  add_read_handler("cache_evictions", read_handler, H_CACHE_EVICTIONS);
+  add_read_handler("rules", read_handler, H_RULES);
+  add_write_handler("rules", write_rules, 0);
+  add_read_handler("rules_version", read_handler, H_RULES_VERSION);
+  add_read_handler("publish_latency", read_handler, H_PUBLISH_LATENCY);
+  _trace.add_handlers(this);
+  _stats.add_handlers(this);
 }
 
-bool retrieveNumericData(Token *currentToken, filter_types *_filter){
+/*Reads a list of numbers. If range is true, each may be a range such as 1024-65535*/
+bool retrieveNumericData(Token *currentToken, filter_types *_filter, bool range = false){
 	if (currentToken == NULL) {
 		click_chatter("Syntax error at retrieveNumericData() \n");
 		return false;
@@ -520,17 +1333,26 @@ bool retrieveNumericData(Token *currentToken, filter_types *_filter){
 	arguments *arg;
 	Token *temp_token = currentToken;
 	String *inputString;
-	uint32_t temp_numeric;
+	uint32_t temp_numeric, temp_end;
 	char * p;
 	while(temp_token != NULL){
 
 		inputString = temp_token->getTokenText();
 		temp_numeric = (uint32_t)strtol(inputString->c_str(), &p, 10);
+		temp_end = temp_numeric;
+		if(range && *p == '-'){
+			temp_end = (uint32_t)strtol(p + 1, &p, 10);
+			if(*p == 0 && (temp_end < temp_numeric || temp_end > 0xFFFF)){
+				click_chatter("Bad range in retrieveNumericData() \n");
+				return false;
+			}
+		}
 		if(*p != 0){
 			click_chatter("Syntax error in retrieveNumericData() \n");
 			return false;
 		}
 		temp_arg->current_argument.numeric_data = temp_numeric;
+		temp_arg->numeric_end = temp_end;
 		if(temp_token->nextToken != NULL){
 			temp_arg->next_argument = new arguments;
 			temp_arg = temp_arg->next_argument;
@@ -540,24 +1362,36 @@ bool retrieveNumericData(Token *currentToken, filter_types *_filter){
 	return true;
 }
 
-bool retrieveIP6AddressData(Token *currentToken, filter_types *_filter){
+/*
+ * Reads a list of IP6 addresses. If prefix is true, each address may carry a
+ * prefix length (2001:db8::/48); a bare network address is a /64.
+ */
+bool retrieveIP6AddressData(Token *currentToken, filter_types *_filter, bool prefix = false){
 	if (currentToken == NULL) {
 		click_chatter("Syntax error at retrieveIP6AddressData() \n");
 		return false;
 	}
 	arguments *temp_arg = _filter->list;
-	arguments *arg;
 	Token *temp_token = currentToken;
 	String *inputString;
 	IP6Address temp_ip6address;
+	int temp_prefix_length;
+	bool parsed;
 	ArgContext arg_context;
 	while (temp_token != NULL) {
 		inputString = temp_token->getTokenText();
-		if (IP6AddressArg::parse(*inputString, temp_ip6address, arg_context) == false) {
+		if (prefix && inputString->find_left('/', 0) >= 0) {
+			parsed = IP6PrefixArg().parse(*inputString, temp_ip6address, temp_prefix_length, arg_context);
+		} else {
+			parsed = IP6AddressArg::parse(*inputString, temp_ip6address, arg_context);
+			temp_prefix_length = (prefix ? 64 : 128);
+		}
+		if (parsed == false) {
 			printf("Syntax error in retrieveIP6AddressData() \n");
 			return false;
 		} else {
-			temp_arg->current_argument.ip6address = new IP6Address(*inputString);
+			temp_arg->current_argument.ip6address = new IP6Address(temp_ip6address);
+			temp_arg->prefix_length = temp_prefix_length;
 			if (temp_token->nextToken != NULL) {
 				temp_arg->next_argument = new arguments;
 				temp_arg = temp_arg->next_argument;
@@ -569,9 +1403,13 @@ bool retrieveIP6AddressData(Token *currentToken, filter_types *_filter){
 }
 
 bool parse_port(Token *currentToken, filter_types *_filter){
+	if (currentToken == NULL) {
+		click_chatter("Syntax error: pattern ends early");
+		return false;
+	}
 	String *currentTokenString = currentToken->getTokenText();
 	if (*currentTokenString == "port") {
-		return retrieveNumericData(currentToken->nextToken, _filter);
+		return retrieveNumericData(currentToken->nextToken, _filter, true);
 	} else {
 		click_chatter("Syntax error in parse_port()");
 		return false;
@@ -583,6 +1421,10 @@ bool parse_ether(Token *currentToken, filter_types *_filter){
 }
 
 bool parse_src_dst(Token *currentToken, filter_types *_filter) {
+	if (currentToken == NULL) {
+		click_chatter("Syntax error: pattern ends early");
+		return false;
+	}
 	String *currentTokenString = currentToken->getTokenText();
 	if (*currentTokenString == "host") {
 		_filter->sub_sub_type = SUB_SUB_TYPE_HOST;
@@ -590,7 +1432,7 @@ bool parse_src_dst(Token *currentToken, filter_types *_filter) {
 
 	} else if (*currentTokenString == "net") {
 		_filter->sub_sub_type = SUB_SUB_TYPE_NET;
-		return retrieveIP6AddressData(currentToken->nextToken, _filter);
+		return retrieveIP6AddressData(currentToken->nextToken, _filter, true);
 
 	} else if (*currentTokenString == "tcp"){
 		_filter->sub_sub_type = SUB_SUB_TYPE_TCP;
@@ -608,6 +1450,10 @@ bool parse_src_dst(Token *currentToken, filter_types *_filter) {
 
 
 bool parse_src_or(Token *currentToken, filter_types *_filter){
+	if (currentToken == NULL) {
+		click_chatter("Syntax error: pattern ends early");
+		return false;
+	}
 	String *currentTokenString = currentToken->getTokenText();
 	if (*currentTokenString == "dst") {
 		_filter->sub_type = SUB_TYPE_SRC_OR_DST;
@@ -619,6 +1465,10 @@ bool parse_src_or(Token *currentToken, filter_types *_filter){
 }
 
 bool parse_src_and(Token *currentToken, filter_types *_filter){
+	if (currentToken == NULL) {
+		click_chatter("Syntax error: pattern ends early");
+		return false;
+	}
 	String *currentTokenString = currentToken->getTokenText();
 	if (*currentTokenString == "dst") {
 		_filter->sub_type = SUB_TYPE_SRC_AND_DST;
@@ -631,6 +1481,10 @@ bool parse_src_and(Token *currentToken, filter_types *_filter){
 
 
 bool parse_ip_proto(Token *currentToken, filter_types *_filter){
+	if (currentToken == NULL) {
+		click_chatter("Syntax error: pattern ends early");
+		return false;
+	}
 	String *currentTokenString = currentToken->getTokenText();
 	if (*currentTokenString == "tcp") {
 		_filter->sub_sub_type = SUB_SUB_TYPE_TCP;
@@ -641,7 +1495,7 @@ bool parse_ip_proto(Token *currentToken, filter_types *_filter){
 		return true;
 
 	} else if (*currentTokenString == "icmp") {
-		_filter->sub_type = SUB_SUB_TYPE_ICMP;
+		_filter->sub_sub_type = SUB_SUB_TYPE_ICMP;
 		return true;
 
 	} else {
@@ -651,6 +1505,10 @@ bool parse_ip_proto(Token *currentToken, filter_types *_filter){
 }
 
 bool parse_dst(Token *currentToken, filter_types *_filter) {
+	if (currentToken == NULL) {
+		click_chatter("Syntax error: pattern ends early");
+		return false;
+	}
 	String *currentTokenString = currentToken->getTokenText();
 	if (*currentTokenString == "host") {
 		_filter->sub_type = SUB_TYPE_DST;
@@ -660,7 +1518,7 @@ bool parse_dst(Token *currentToken, filter_types *_filter) {
 	} else if (*currentTokenString == "net") {
 		_filter->sub_type = SUB_TYPE_DST;
 		_filter->sub_sub_type = SUB_SUB_TYPE_NET;
-		return retrieveIP6AddressData(currentToken->nextToken, _filter);
+		return retrieveIP6AddressData(currentToken->nextToken, _filter, true);
 
 	} else if (*currentTokenString == "tcp"){
 		_filter->sub_type = SUB_TYPE_DST;
@@ -679,6 +1537,10 @@ bool parse_dst(Token *currentToken, filter_types *_filter) {
 }
 
 bool parse_src(Token *currentToken, filter_types *_filter) {
+	if (currentToken == NULL) {
+		click_chatter("Syntax error: pattern ends early");
+		return false;
+	}
 	String *currentTokenString = currentToken->getTokenText();
 
 	if (*currentTokenString == "and") {
@@ -697,7 +1559,7 @@ bool parse_src(Token *currentToken, filter_types *_filter) {
 	} else if (*currentTokenString == "net") {
 		_filter->sub_type = SUB_TYPE_SRC;
 		_filter->sub_sub_type = SUB_SUB_TYPE_NET;
-		return retrieveIP6AddressData(currentToken->nextToken, _filter);
+		return retrieveIP6AddressData(currentToken->nextToken, _filter, true);
 
 	} else if (*currentTokenString == "tcp") {
 		_filter->sub_type = SUB_TYPE_SRC;
@@ -718,6 +1580,10 @@ bool parse_src(Token *currentToken, filter_types *_filter) {
 
 
 bool parse_icmp(Token *currentToken, filter_types *_filter) {
+	if (currentToken == NULL) {
+		click_chatter("Syntax error: pattern ends early");
+		return false;
+	}
 	String *currentTokenString = currentToken->getTokenText();
 	if(*currentTokenString == "type") {
 		if(currentToken->nextToken != NULL){
@@ -733,6 +1599,10 @@ bool parse_icmp(Token *currentToken, filter_types *_filter) {
 }
 
 bool parse_ip(Token *currentToken, filter_types *_filter){
+	if (currentToken == NULL) {
+		click_chatter("Syntax error: pattern ends early");
+		return false;
+	}
 	String *currentTokenString = currentToken->getTokenText();
 	if(*currentTokenString == "proto") {
 		_filter->sub_type = SUB_TYPE_IP_PROTO;
@@ -769,6 +1639,10 @@ bool parse_ip(Token *currentToken, filter_types *_filter){
 }
 
 bool pattern(Token *currentToken, filter_types *_filter){
+	if (currentToken == NULL) {
+		click_chatter("Syntax error: pattern ends early");
+		return false;
+	}
 	String *currentTokenString = currentToken->getTokenText();
 	if(*currentTokenString == "ip") {
 		_filter->type = TYPE_IP;
@@ -796,7 +1670,7 @@ bool pattern(Token *currentToken, filter_types *_filter){
 		_filter->sub_type = SUB_TYPE_SRC_OR_DST;
 		_filter->sub_sub_type = SUB_SUB_TYPE_UDP;
 		return parse_port(currentToken->nextToken, _filter);
-	} else if(*currentTokenString == "true") {
+	} else if(*currentTokenString == "true" || *currentTokenString == "-") {
 		_filter->type = TYPE_TRUE;
 		if(currentToken->nextToken == NULL){
 			return true;
@@ -818,5 +1692,132 @@ bool pattern(Token *currentToken, filter_types *_filter){
 	}
 }
 
+/*Returns whether t is an operator or a parenthesis rather than part of a test*/
+static bool
+is_operator(Token *t){
+	String *s = t->getTokenText();
+	return *s == "and" || *s == "&&" || *s == "or" || *s == "||"
+		|| *s == "not" || *s == "!" || *s == "(" || *s == ")";
+}
+
+/*
+ * Recursive descent parser of patterns combining tests. Each test is parsed
+ * by pattern() into a filter of its own, appended to tests; the pattern is
+ * turned into a postfix program over those tests.
+ */
+struct expr_parser{
+	Token *token;			//next token to read
+	Vector<filter_types *> &tests;
+	Vector<expr_pattern::op> &program;
+	ErrorHandler *errh;
+
+	expr_parser(Token *_token, Vector<filter_types *> &_tests, Vector<expr_pattern::op> &_program, ErrorHandler *_errh)
+		: token(_token), tests(_tests), program(_program), errh(_errh){};
+
+	//Consumes the next token if it reads a or b
+	bool accept(const char *a, const char *b = NULL){
+		if (token != NULL && (*token->getTokenText() == a || (b && *token->getTokenText() == b))) {
+			token = token->nextToken;
+			return true;
+		}
+		return false;
+	}
+	void emit(int code, int test = 0){
+		expr_pattern::op o;
+		o.code = code;
+		o.test = test;
+		program.push_back(o);
+	}
+	bool parse_or(){
+		if (!parse_and()) {
+			return false;
+		}
+		while (accept("or", "||")) {
+			if (!parse_and()) {
+				return false;
+			}
+			emit(expr_pattern::OP_OR);
+		}
+		return true;
+	}
+	bool parse_and(){
+		if (!parse_not()) {
+			return false;
+		}
+		while (accept("and", "&&")) {
+			if (!parse_not()) {
+				return false;
+			}
+			emit(expr_pattern::OP_AND);
+		}
+		return true;
+	}
+	bool parse_not(){
+		if (accept("not", "!")) {
+			if (!parse_not()) {
+				return false;
+			}
+			emit(expr_pattern::OP_NOT);
+			return true;
+		} else if (accept("(")) {
+			if (!parse_or()) {
+				return false;
+			}
+			if (!accept(")")) {
+				errh->error("missing )");
+				return false;
+			}
+			return true;
+		}
+		return parse_test();
+	}
+	//A test runs up to the next operator, except for src and dst and src or dst
+	bool parse_test(){
+		Token *first = token, *last = NULL, *t = token;
+		while (t != NULL) {
+			if (is_operator(t)) {
+				String *s = t->getTokenText();
+				if (last != first || *last->getTokenText() != "src" || (*s != "and" && *s != "or")
+					|| t->nextToken == NULL || *t->nextToken->getTokenText() != "dst") {
+					break;
+				}
+			}
+			last = t;
+			t = t->nextToken;
+		}
+		if (last == NULL) {
+			errh->error(t ? "expected a test before %<%s%>" : "expected a test", t ? t->getTokenText()->c_str() : "");
+			return false;
+		}
+		filter_types *f = new filter_types;
+		last->nextToken = NULL;
+		bool parsed = pattern(first, f);
+		last->nextToken = t;
+		token = t;
+		if (!parsed) {
+			delete f;
+			errh->error("syntax error");
+			return false;
+		}
+		tests.push_back(f);
+		emit(expr_pattern::OP_TEST, tests.size() - 1);
+		return true;
+	}
+};
+
+/*Parses a pattern into program, appending the filters of its tests to tests*/
+bool parse_expression(Token *currentToken, Vector<filter_types *> &tests, Vector<expr_pattern::op> &program,
+					  ErrorHandler *errh){
+	expr_parser parser(currentToken, tests, program, errh);
+	if (!parser.parse_or()) {
+		return false;
+	}
+	if (parser.token != NULL) {
+		errh->error("unexpected %<%s%>", parser.token->getTokenText()->c_str());
+		return false;
+	}
+	return true;
+}
+
 CLICK_ENDDECLS
 EXPORT_ELEMENT(IP6Classifier)
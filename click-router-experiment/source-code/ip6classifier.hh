@@ -3,11 +3,27 @@
 #include <click/element.hh>
 #include <click/glue.hh>
 #include <click/ip6address.hh>
+#include <click/hashtable.hh>
+#include <click/task.hh>
+#include <click/notifier.hh>
+#include <click/timer.hh>
+#include <click/sync.hh>
+#include <clicknet/ip6.h>
+#include "ip6trace.hh"
+#include "ip6stats.hh"
+#if defined(__x86_64__) && !defined(CLICK_LINUXMODULE)
+# include <emmintrin.h>
+# define ADDRESS_TABLE_SSE2 1
+# if defined(__GNUC__)
+#  define ADDRESS_TABLE_AVX2 1
+# endif
+#endif
 CLICK_DECLS
 
 /*
  * =c
- * IP6Classifier([BADADDRS, OFFSET])
+ * IP6Classifier(PATTERN_1, ..., PATTERN_N [, I<keywords> MATCH, CACHE, BURST,
+ * TRACE, TRACE_RATE])
  * =s ip6
  *
  * =d
@@ -34,8 +50,147 @@ CLICK_DECLS
  *
  * Unsigned integer. Byte position at which the IP6 header begins. Default is 0.
  *
+ * =item MATCH
+ *
+ * Either C<first> or C<all>. With C<first>, the default, a packet is emitted
+ * on the output of the first pattern it matches, without being copied. With
+ * C<all>, it is emitted on the output of every pattern it matches, cloned for
+ * all but the last. A packet matching no pattern is emitted on the output
+ * following the last pattern's if that output exists, and dropped otherwise.
+ * The pattern C<-> is a synonym for C<true>.
+ *
+ * =item CACHE
+ *
+ * Unsigned integer. Number of flows remembered by the flow cache of each
+ * thread. Packets
+ * with the same source and destination addresses, flow label, upper layer
+ * protocol and ports (or ICMP type) are classified once and then sent where
+ * the cache says. Only used when no pattern tests another header field
+ * (C<ip vers>, C<ip hll>, C<ip cos>, C<ip frag>, C<ip unfrag>). Default is
+ * 0, no cache.
+ *
+ * =item BURST
+ *
+ * Integer between 1 and 256. When the input is pull, the element pulls up to
+ * BURST packets each time it is scheduled and classifies them as a batch:
+ * the headers of the whole batch are prefetched before any is parsed, and
+ * in first-match mode packets leave grouped by output. Default is 32.
+ *
+ * =item TRACE
+ *
+ * Boolean. Whether to record packets matching no pattern, and those dropped
+ * for want of an output for them, in the trace read by C<trace_dump>.
+ * Default is false.
+ *
+ * =item TRACE_RATE
+ *
+ * Unsigned integer. Events recorded per second and per thread at most when
+ * tracing; later ones are only counted. Default is 100.
+ *
  * =back
  *
+ * =h drops read-only
+ *
+ * Number of packets dropped, for any reason.
+ *
+ * =h drop_counts read-only
+ *
+ * Number of packets dropped for each reason, one reason per line:
+ * C<no-match> (matched no pattern and there is no output for unmatched
+ * packets), C<no-memory> (a clone failed) and the reasons of the other IP6
+ * elements, which stay zero here.
+ *
+ * =h port_counts read-only
+ *
+ * One line per output: the output number, then the packets and bytes sent on
+ * it. Clones count on every output they are sent to.
+ *
+ * =h reset write-only
+ *
+ * Zeroes the port and drop counters, and the profiles.
+ *
+ * =h profile read-only
+ *
+ * Only when built with CLICK_STATS of 2 or more, or with IP6_PROFILE defined
+ * to 1. Cycles spent classifying each packet before sending it on, without
+ * the elements downstream: one line per output that has samples, then
+ * C<drops> and C<all>, each with the number of samples and the 50th, 99th
+ * and 99.9th percentiles.
+ *
+ * =h profile_buckets read-only
+ *
+ * The histograms behind C<profile>: one line per nonempty bucket, with the
+ * output, the lowest cycle count of the bucket and its number of samples.
+ *
+ * =h cache_hits read-only
+ *
+ * Number of packets classified by the flow caches of all threads.
+ *
+ * =h cache_misses read-only
+ *
+ * Number of packets looked up in the flow cache but classified by the
+ * decision tree.
+ *
+ * =h cache_evictions read-only
+ *
+ * Number of flows evicted from the full flow cache to make room for others.
+ *
+ * =h rules read/write
+ *
+ * The patterns in use, one per line. Writing a comma-separated list of
+ * patterns replaces them while traffic flows: the new patterns are compiled
+ * beside the old ones and published in one pointer swap. Packets already
+ * being classified finish with the old patterns, which are freed once no
+ * thread can still be reading them. No packet is dropped or held back during
+ * the swap. There may not be more patterns than outputs; unmatched packets go
+ * to the output following the last new pattern's, if it exists. The flow
+ * cache starts empty with the new patterns. The other keywords keep their
+ * values.
+ *
+ * =h rules_version read-only
+ *
+ * Number of pattern sets published by writing the C<rules> handler.
+ *
+ * =h publish_latency read-only
+ *
+ * Time in seconds the last write to C<rules> took, from parsing the
+ * patterns to the new ones being visible to every thread.
+ *
+ * =h trace read/write
+ *
+ * Whether tracing is on, as with the TRACE keyword.
+ *
+ * =h trace_dump read-only
+ *
+ * The events recorded by each thread, oldest first: time, thread, event
+ * name and one number. At most the last 64 are kept per thread.
+ *
+ * The patterns are compiled at configure time into a decision tree: one node
+ * per distinct header field tested by any pattern, each mapping the field
+ * values named in the configuration to the sorted list of output ports they
+ * select. Port and 8-bit field values are looked up in bitmaps, host
+ * addresses in open addressing hash tables compared with SIMD instructions
+ * where the CPU supports them. Patterns that can never match (C<false>,
+ * C<ether>, C<net> prefixes with host bits set) are pruned. A packet is
+ * therefore classified with one lookup per distinct field, however many
+ * patterns test that field.
+ *
+ * A pattern may combine tests with C<and> (C<&&>), C<or> (C<||>), C<not> (C<!>)
+ * and parentheses, as in C<tcp port 1024-65535 and not (src net
+ * 2001:db8::/32 or ip hll 1)>. C<not> binds tightest, then C<and>, then C<or>.
+ * Every test of every such pattern is compiled into the same decision tree as
+ * the plain patterns, so one lookup per field finds every test a packet
+ * passes, and each combined pattern then costs a few boolean operations. C<and> and
+ * C<or> right after C<src> still mean C<src and dst> and C<src or dst>.
+ * Combined patterns and their tests may number at most 1024 in all.
+ *
+ * Port arguments may be ranges, as in C<dst tcp port 6000-6063>.
+ *
+ * C<net> tests take prefixes of any length, as in C<src net 2001:db8::/48>; a
+ * bare address is a /64. The prefixes of all C<net> patterns on one field are
+ * compiled into a multibit trie with 6-bit strides, so a lookup touches at most
+ * one node per 6 bits of the longest prefix whatever the number of prefixes.
+ *
  * =a MarkIP6Header */
 
 enum{
@@ -70,21 +225,154 @@ enum{
 	  SUB_SUB_TYPE_ICMP = 405
 };
 
+/*Header fields tested by the nodes of the decision tree*/
+enum{
+	  FIELD_TRUE = 0,			//no field, every packet takes this branch
+	  FIELD_VERS,				//IP version
+	  FIELD_HLIM,				//hop limit
+	  FIELD_COS,				//traffic class
+	  FIELD_FLOW,				//flow label
+	  FIELD_FRAG,				//1 if a fragment header is present, 0 otherwise
+	  FIELD_PROTO,				//upper layer protocol
+	  FIELD_SRC_HOST,
+	  FIELD_DST_HOST,
+	  FIELD_SRC_AND_DST_HOST,	//source address, only if it equals the destination
+	  FIELD_SRC_NET,			//source address prefix
+	  FIELD_DST_NET,
+	  FIELD_SRC_AND_DST_NET,	//prefixes holding both the source and the destination
+	  FIELD_SRC_PORT,			//(protocol << 16) | source port
+	  FIELD_DST_PORT,
+	  FIELD_SRC_AND_DST_PORT,	//source port, only if it equals the destination port
+	  FIELD_ICMP_TYPE,
+	  FIELD_COUNT
+};
+
 /*List of parameters given to classification criteria*/
 struct arguments {
 	union {
 		uint32_t numeric_data;	//numeric parameters
 		IP6Address *ip6address;	//ip address parameters
 	} current_argument;
+	uint32_t numeric_end;	//last value of a port range, numeric_data for single values
+	uint8_t prefix_length;	//prefix length of network address parameters
 	arguments *next_argument;
 
 	//Constructor
 	arguments(){
 		current_argument.ip6address = NULL;
+		numeric_end = 0;
+		prefix_length = 128;
 		next_argument = NULL;
 	};
 };
 
+/*
+ * Set of small integers (ports, ICMP types, header bytes) kept as a bitmap.
+ * Each member may also map to a leaf: members are ranked by counting the
+ * bits set below them, so the leaves need no space for absent values.
+ */
+struct value_map{
+	Vector<uint64_t> bitmap;
+	Vector<uint32_t> rank;		//number of members below each bitmap word
+	Vector<int> leaves;			//leaf of each member, in increasing value order
+
+	void init(int bits);
+	void insert(uint32_t value);
+	void finish();				//computes ranks once every member is inserted
+	void set_leaf(uint32_t value, int leaf);
+
+	inline bool contains(uint32_t value) const{
+		return ((int) (value >> 6) < bitmap.size()) && (bitmap[value >> 6] & (1ULL << (value & 63)));
+	}
+	//Returns the leaf of value, -1 if it is not a member
+	inline int lookup(uint32_t value) const{
+		if (!contains(value)) {
+			return -1;
+		}
+		return leaves[rank[value >> 6] + __builtin_popcountll(bitmap[value >> 6] & ((1ULL << (value & 63)) - 1))];
+	}
+};
+
+/*
+ * Open addressing hash table from IP6 addresses to leaves. Addresses are
+ * packed four to a 64-byte aligned bucket, the size of a cache line, and a
+ * lookup compares the key with a whole bucket: two addresses per instruction
+ * with AVX2, one with SSE2, four scalar words per address otherwise. AVX2 is
+ * used only if the CPU running the router has it. Full buckets overflow
+ * into the next one.
+ */
+struct address_table{
+	enum{
+		WAYS = 4
+	};
+	struct bucket{
+		click_in6_addr addr[WAYS];
+	};
+	bucket *buckets;			//at most half full
+	unsigned char *memory;		//allocation holding the aligned buckets
+	Vector<int> values;			//value of each slot, -1 if the slot is empty
+	uint32_t mask;				//number of buckets - 1
+	bool avx2;					//compare buckets with AVX2
+
+	address_table(): buckets(0), memory(0), mask(0), avx2(false){};
+	~address_table(){
+		delete[] memory;
+	}
+	void init(int n);
+	void insert(const click_in6_addr &addr, int value);
+	int lookup_avx2(const click_in6_addr &addr) const;
+
+	static inline uint32_t hash(const click_in6_addr &addr){
+		uint64_t h = ((uint64_t) (addr.s6_addr32[0] ^ addr.s6_addr32[2]) << 32) | (addr.s6_addr32[1] ^ addr.s6_addr32[3]);
+		h *= 0x9E3779B97F4A7C15ULL;
+		return h >> 32;
+	}
+	//Returns a mask of the ways of b holding addr
+	static inline uint32_t match(const bucket &b, const click_in6_addr &addr){
+		uint32_t ways = 0;
+#if ADDRESS_TABLE_SSE2
+		__m128i key = _mm_loadu_si128((const __m128i *) &addr);
+		for (int i = 0; i < WAYS; i++) {
+			__m128i eq = _mm_cmpeq_epi32(_mm_load_si128((const __m128i *) &b.addr[i]), key);
+			ways |= (_mm_movemask_epi8(eq) == 0xFFFF) << i;
+		}
+#else
+		for (int i = 0; i < WAYS; i++) {
+			const click_in6_addr &a = b.addr[i];
+			ways |= (a.s6_addr32[0] == addr.s6_addr32[0] && a.s6_addr32[1] == addr.s6_addr32[1]
+					 && a.s6_addr32[2] == addr.s6_addr32[2] && a.s6_addr32[3] == addr.s6_addr32[3]) << i;
+		}
+#endif
+		return ways;
+	}
+	//Returns the value of addr, -1 if it is not in the table
+	inline int lookup(const click_in6_addr &addr) const{
+		if (!buckets) {
+			return -1;
+		}
+#if ADDRESS_TABLE_AVX2
+		if (avx2) {
+			return lookup_avx2(addr);
+		}
+#endif
+		for (uint32_t i = hash(addr) & mask; ; i = (i + 1) & mask) {
+			uint32_t ways = match(buckets[i], addr);
+			const int *v = &values[i * WAYS];
+			//slots fill in order and hold distinct addresses, so the first
+			//matching slot is the only one; if it is empty, addr is :: and absent.
+			//Selecting the result without a branch avoids mispredicting hits and misses
+			if (ways || v[WAYS - 1] < 0) {
+				int value = v[__builtin_ctz(ways | 1 << (WAYS - 1))];
+				return ways ? value : -1;
+			}
+		}
+	}
+
+private:
+	address_table(const address_table &);
+	address_table &operator=(const address_table &);
+};
+
 /*List of patterns*/
 struct filter_types{
 	uint16_t output_port;	//output port of packets matching this pattern
@@ -95,9 +383,244 @@ struct filter_types{
 	filter_types *next_pattern;
 	//Constructor
 	filter_types(){
+		type = sub_type = sub_sub_type = 0;
 		list = new arguments;
 		next_pattern = NULL;
 	}
+	~filter_types();
+};
+
+/*Result of walking the extension header chain of one packet, built once
+ * before classification and read by every lookup*/
+struct parse_descriptor{
+	const click_ip6 *ip;	//IP6 header
+	int l4_proto;			//upper layer protocol, -1 if none was found
+	int l4_offset;			//offset of the upper layer header from the IP6 header, -1 if absent
+	uint16_t src_port;		//TCP and UDP only
+	uint16_t dst_port;
+	uint8_t icmp_type;		//ICMP only
+	bool fragmented;		//a fragment header was found
+	uint16_t frag_offset;	//fragment offset in bytes
+};
+
+struct decision_tree;
+
+/*Network prefix named by a net pattern*/
+struct prefix_entry{
+	IP6Address addr;
+	int prefix_length;
+	int output_port;
+};
+
+/*
+ * Multibit trie over IP6 addresses with 6-bit strides (poptrie).
+ * Each node covers 64 slots: bit i of vector is set when slot i leads to a
+ * child node, and bit i of leafvec is set where a new run of identical leaves
+ * starts among the other slots. Children and leaves of a node are stored
+ * contiguously and found by counting the bits set below the slot.
+ * Leaves are pushed down at build time, so the leaf reached by the longest
+ * matching prefix already lists the ports of every shorter matching prefix.
+ */
+struct prefix_trie{
+	struct trie_node{
+		uint64_t vector;	//slots leading to a child node
+		uint64_t leafvec;	//slots starting a run of leaves
+		uint32_t base0;		//index of the first leaf of this node
+		uint32_t base1;		//index of the first child of this node
+	};
+	Vector<trie_node> nodes;	//nodes[0] is the root
+	Vector<int> leaves;			//decision tree leaf indices, -1 if no prefix matches
+
+	enum{
+		STRIDE = 6
+	};
+
+	void build(decision_tree *tree, const Vector<prefix_entry> &prefixes);
+	void build_node(decision_tree *tree, int index, const Vector<const prefix_entry *> &prefixes,
+					int offset, const Vector<int> &inherited);
+	int lookup(const click_in6_addr &addr) const;
+};
+
+/*Node of the decision tree: maps the values of one header field to leaves*/
+struct decision_node{
+	uint16_t field;						//FIELD_* tested by this node
+	HashTable<uint32_t, int> values;	//flow label -> leaf index
+	value_map small_values;				//8-bit field value -> leaf index
+	value_map ports[2];					//TCP, UDP port -> leaf index
+	address_table addresses;			//host address -> leaf index
+	prefix_trie trie;					//network prefix -> leaf index
+	int default_leaf;					//leaf taken whatever the value (FIELD_TRUE)
+	//Constructor
+	decision_node(uint16_t _field): field(_field), default_leaf(-1){};
+};
+
+/*Patterns compiled at configure time*/
+struct decision_tree{
+	Vector<decision_node *> nodes;		//only the fields tested by some pattern
+	Vector<Vector<int> > leaves;		//sorted output ports, shared between nodes
+	HashTable<String, int> leaf_ids;	//ports of a leaf -> leaf index, used while compiling
+	bool key_fields_only;				//no pattern tests a field outside flow_key
+
+	decision_tree(): key_fields_only(true){};
+
+	int add_leaf(const Vector<int> &ports);
+	//Destructor
+	~decision_tree(){
+		for (int i = 0; i < nodes.size(); i++) {
+			delete nodes[i];
+		}
+	}
+};
+
+/*Header fields a flow cache entry is keyed on*/
+struct flow_key{
+	click_in6_addr src;
+	click_in6_addr dst;
+	uint32_t flow;			//flow label
+	uint16_t src_port;		//TCP and UDP only
+	uint16_t dst_port;		//ICMP type for ICMP
+	int16_t proto;			//upper layer protocol, -1 if none was found
+	uint16_t padding;		//always 0, so keys compare with memcmp
+};
+
+/*
+ * Bounded exact match cache from flow_key to the output ports a flow was
+ * classified to. The table is 4-way set associative; a set that is full
+ * evicts with the clock algorithm, skipping the entries hit since the hand
+ * last passed them. Every thread has a cache of its own, so entries and
+ * counters are only ever written by one thread.
+ */
+struct flow_cache{
+	enum{
+		WAYS = 4,
+		MAX_PORTS = 4			//flows matching more patterns are not cached
+	};
+	struct entry{
+		flow_key key;
+		int8_t nports;			//-1 if the entry is free, 0 for unmatched flows
+		uint8_t referenced;		//hit since the clock hand last passed
+		int ports[MAX_PORTS];
+	};
+	Vector<entry> entries;		//WAYS consecutive entries per set
+	Vector<uint8_t> hands;		//clock hand of each set
+	uint32_t mask;				//number of sets - 1
+	uint64_t hits;
+	uint64_t misses;
+	uint64_t evictions;
+	char padding[64];			//keeps the caches of different threads off one cache line
+
+	flow_cache(): mask(0), hits(0), misses(0), evictions(0){};
+	void init(int size);
+	void insert(const flow_key &key, uint32_t hash, const int *ports, int nports);
+
+	static inline uint32_t hash(const flow_key &key){
+		uint64_t h = ((uint64_t) address_table::hash(key.src) << 32) | address_table::hash(key.dst);
+		h ^= ((uint64_t) key.flow << 32) | ((uint32_t) key.src_port << 16) | key.dst_port;
+		h ^= (uint16_t) key.proto;
+		h *= 0x9E3779B97F4A7C15ULL;
+		return h >> 32;
+	}
+	inline void prefetch(uint32_t hash) const{
+		if (!entries.empty()) {
+			const entry *e = &entries[(hash & mask) * WAYS];
+			for (int i = 0; i < WAYS; i++) {
+				__builtin_prefetch(e + i);
+			}
+		}
+	}
+	//Returns the entry of key, NULL if it is not cached
+	inline entry *lookup(const flow_key &key, uint32_t hash){
+		if (entries.empty()) {
+			return NULL;
+		}
+		entry *e = &entries[(hash & mask) * WAYS];
+		for (int i = 0; i < WAYS; i++, e++) {
+			if (e->nports >= 0 && memcmp(&e->key, &key, sizeof(flow_key)) == 0) {
+				e->referenced = 1;
+				return e;
+			}
+		}
+		return NULL;
+	}
+};
+
+/*
+ * Pattern combining tests with and, or and not, as a postfix program. Each
+ * test is compiled into the decision tree as a pattern of its own, with an
+ * output port above those of the real patterns; the program then combines
+ * the bits of the tests a packet passes.
+ */
+struct expr_pattern{
+	enum{
+		OP_TEST, OP_NOT, OP_AND, OP_OR,
+		STACK_MAX = 64		//the stack is kept in one word
+	};
+	struct op{
+		uint16_t code;
+		uint16_t test;		//port of the test, for OP_TEST
+	};
+	int output_port;
+	Vector<op> program;
+
+	//Returns whether a packet passing the tests set in bits matches
+	inline bool matches(const uint64_t *bits) const{
+		uint64_t stack = 0;		//bit 0 is the top
+		for (int i = 0; i < program.size(); i++) {
+			const op &o = program[i];
+			switch (o.code) {
+			case OP_TEST:
+				stack = (stack << 1) | ((bits[o.test >> 6] >> (o.test & 63)) & 1);
+				break;
+			case OP_NOT:
+				stack ^= 1;
+				break;
+			case OP_AND:
+				stack = ((stack >> 2) << 1) | (stack & (stack >> 1) & 1);
+				break;
+			case OP_OR:
+				stack = ((stack >> 2) << 1) | ((stack | (stack >> 1)) & 1);
+				break;
+			}
+		}
+		return stack & 1;
+	}
+};
+
+/*
+ * Everything compiled from one list of patterns. The data path reaches it
+ * through a single pointer, so a new set can be built beside the one in use
+ * and published atomically.
+ */
+struct rule_set{
+	filter_types *root_filter;
+	decision_tree *tree;
+	flow_cache *caches;			//one per thread
+	int ncaches;
+	bool use_cache;
+	int npatterns;
+	Vector<expr_pattern> exprs;	//patterns combining several tests
+	Vector<String> patterns;	//configuration of each pattern, for the rules handler
+
+	enum{
+		PORTS_MAX = 1024,		//patterns and tests, if some pattern combines tests
+		PORT_WORDS = PORTS_MAX / 64
+	};
+
+	rule_set(): root_filter(NULL), tree(NULL), caches(NULL), ncaches(0), use_cache(false), npatterns(0){};
+	~rule_set();
+
+	//Returns the flow cache of the calling thread
+	inline flow_cache &cache(){
+		return caches[click_current_cpu_id()];
+	}
+	//Returns the sum of a counter over the caches of every thread
+	uint64_t cache_count(uint64_t flow_cache::*counter) const{
+		uint64_t n = 0;
+		for (int i = 0; i < ncaches; i++) {
+			n += caches[i].*counter;
+		}
+		return n;
+	}
 };
 
 class Token {
@@ -121,34 +644,98 @@ class IP6Classifier : public Element {
 #ifdef CLICK_LINUXMODULE
   bool _aligned;
 #endif
-  int _drops;
+  bool _match_all;	// send packets to every matching output, not just the first
+  uint32_t _cache_size;
+
+  /*Rule sets are published with an epoch scheme: a thread classifying
+   * packets announces the epoch it started in, and a replaced rule set is
+   * freed once no thread announces an epoch older than its replacement*/
+  struct reader{
+	  uint64_t epoch;	// 0 while the thread is not classifying
+	  uint32_t depth;	// nested entries, if a packet comes back to this element
+	  char padding[64 - sizeof(uint64_t) - sizeof(uint32_t)];
+  };
+  struct retired_rules{
+	  rule_set *rules;
+	  uint64_t epoch;	// first epoch in which rules was unreachable
+  };
+  rule_set *_rules;				// published rules, read by the data path
+  uint64_t _epoch;
+  reader *_readers;				// one per thread
+  unsigned _nreaders;
+  Vector<retired_rules> _retired;
+  Spinlock _retired_lock;
+  Timer _reclaim_timer;
+  uint32_t _rules_version;
+  Timestamp _publish_latency;
+  IP6Trace _trace;
+  IP6Stats _stats;
+
+  Task _task;
+  NotifierSignal _signal;
+  int _burst;		// packets pulled per task run
+
+  enum{
+	  BURST_MAX = 256,
+	  SENT = -2		// push_batch(): packet already emitted
+  };
+  struct leaf_cursor;
+
+  decision_tree *compile(filter_types *root, ErrorHandler *errh);
+  rule_set *build_rules(const Vector<String> &conf, ErrorHandler *errh);
+  void publish(rule_set *rules);
+  void reclaim();
+  void parse(Packet *p, parse_descriptor &d);
+  int lookup(const decision_node *node, const parse_descriptor &d, int &filter_leaf);
+  void push_matches(Packet *p, int npatterns, const int *ports, int nports);
+  inline bool make_key(const parse_descriptor &d, flow_key &key, uint32_t &hash);
+  inline int lookup_nodes(const decision_tree *tree, const parse_descriptor &d, leaf_cursor *hits);
+  void match_exprs(const rule_set *rules, const parse_descriptor &d, uint64_t *bits);
+  int first_match(rule_set *rules, const parse_descriptor &d, const flow_key *key, uint32_t hash);
+  void push_all_matches(rule_set *rules, Packet *p, const parse_descriptor &d, const flow_key *key, uint32_t hash);
+
+  //Returns the rules in use; they stay valid until the matching leave()
+  inline rule_set *enter(reader &r){
+	  if (r.depth++ == 0) {
+		  __atomic_store_n(&r.epoch, __atomic_load_n(&_epoch, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+		  //the epoch must be visible before the rules pointer is read
+		  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+	  }
+	  return __atomic_load_n(&_rules, __ATOMIC_ACQUIRE);
+  }
+  inline void leave(reader &r){
+	  if (--r.depth == 0) {
+		  __atomic_store_n(&r.epoch, 0, __ATOMIC_RELEASE);
+	  }
+  }
+  inline reader &current_reader(){
+	  return _readers[click_current_cpu_id()];
+  }
+
+  static String read_handler(Element *e, void *thunk);
+  static int write_rules(const String &s, Element *e, void *thunk, ErrorHandler *errh);
 
  public:
-  filter_types *root_filter;
 
   IP6Classifier();
   ~IP6Classifier();
 
   const char *class_name() const		{ return "IP6Classifier"; }
-  const char *port_count() const		{ return "1/-6"; }
-  const char *processing() const		{ return PUSH; }
+  const char *port_count() const		{ return "1/-"; }
+  const char *processing() const		{ return "a/h"; }
 
   Token* parseConfigurationString(String);
-  int match_filter(filter_types *_filter, Packet *p);
-  int match_transport_protocols(filter_types *_filter, Packet *p);
-  int match_ip(filter_types *_filter, Packet *p);
-  int match_ip6header(int option, uint32_t parameter, Packet *p);
-  int match_pattern(filter_types *_filter, Packet *p);
-  int isFragmented(Packet *p);
-  int match_ip6_hdr_fields(filter_types *_filter, Packet *p);
   int configure(Vector<String> &, ErrorHandler *);
-  inline bool compare_host_net(int option, IP6Address left, IP6Address *right);
 
-  int drops() const				{ return _drops; }
+  uint64_t drops() const			{ return _stats.drops(); }
 
 
+  int initialize(ErrorHandler *);
   void add_handlers();
   void push(int, Packet *p);
+  void push_batch(Packet **packets, int n);
+  bool run_task(Task *);
+  void run_timer(Timer *);
 };
 
 CLICK_ENDDECLS
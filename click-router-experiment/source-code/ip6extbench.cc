@@ -0,0 +1,327 @@
+/*
+ * ip6extbench.{cc,hh} -- microbenchmark of the IP6 extension header elements
+ */
+
+#include <click/config.h>
+#include "ip6extbench.hh"
+#include <clicknet/ip6.h>
+#include <click/args.hh>
+#include <click/ip6address.hh>
+#include <click/confparse.hh>
+#include <click/error.hh>
+#include <click/glue.hh>
+#include <click/cycles.hh>
+#include <click/straccum.hh>
+#include <click/timestamp.hh>
+CLICK_DECLS
+
+IP6ExtBench::IP6ExtBench()
+  : _chain("tcp"), _count(1000000), _payload(64)
+{
+}
+
+IP6ExtBench::~IP6ExtBench()
+{
+}
+
+int
+IP6ExtBench::configure(Vector<String> &conf, ErrorHandler *errh)
+{
+    if (Args(conf, this, errh)
+	.read_p("CHAIN", AnyArg(), _chain)
+	.read("COUNT", _count)
+	.read("PAYLOAD", _payload)
+	.complete() < 0)
+	return -1;
+    if (_count == 0)
+	return errh->error("COUNT must be positive");
+    //check the chain now rather than at the first run
+    if (WritablePacket *p = make_packet(_chain, errh)) {
+	p->kill();
+	return 0;
+    }
+    return -1;
+}
+
+static void
+append(Vector<unsigned char> &v, const void *data, int len)
+{
+	const unsigned char *d = reinterpret_cast<const unsigned char *>(data);
+	for (int i = 0; i < len; i++) {
+		v.push_back(d[i]);
+	}
+}
+
+static void
+append_u16(Vector<unsigned char> &v, uint16_t x)
+{
+	v.push_back(x >> 8);
+	v.push_back(x);
+}
+
+static void
+append_u32(Vector<unsigned char> &v, uint32_t x)
+{
+	append_u16(v, x >> 16);
+	append_u16(v, x);
+}
+
+/*Headers a chain is made of*/
+enum{
+	H_HBH_PADN, H_HBH_RA, H_HBH_JUMBO, H_DEST, H_RH0, H_FRAG, H_ESP, H_TCP, H_UDP, H_ICMP
+};
+
+static const struct{
+	const char *name;
+	int proto;		//Next Header value naming it
+} header_kinds[] = {
+	{ "hbh-padn", 0 }, { "hbh-ra", 0 }, { "hbh-jumbo", 0 }, { "dest", 60 },
+	{ "rh0", 43 }, { "frag", 44 }, { "esp", 50 }, { "tcp", 6 }, { "udp", 17 },
+	{ "icmp", 58 }
+};
+
+/*Builds the packet of chain, or reports why it cannot*/
+WritablePacket *
+IP6ExtBench::make_packet(const String &chain, ErrorHandler *errh)
+{
+	Vector<String> words;
+	Vector<int> kinds, naddrs;
+	cp_spacevec(chain, words);
+	for (int i = 0; i < words.size(); i++) {
+		String w = words[i];
+		int naddr = 0;
+		if (w.starts_with("rh0:")) {
+			if (!IntArg().parse(w.substring(4), naddr) || naddr < 1 || naddr > 23) {
+				errh->error("%s: a type 0 routing header holds 1 to 23 addresses", w.c_str());
+				return 0;
+			}
+			w = "rh0";
+		}
+		int k = 0;
+		while (k <= H_ICMP && w != header_kinds[k].name) {
+			k++;
+		}
+		if (k > H_ICMP || (k == H_RH0 && naddr == 0)) {
+			errh->error("unknown header %<%s%>", words[i].c_str());
+			return 0;
+		}
+		if (!kinds.empty() && kinds.back() >= H_ESP) {
+			errh->error("%<%s%> follows an upper layer header", words[i].c_str());
+			return 0;
+		}
+		kinds.push_back(k);
+		naddrs.push_back(naddr);
+	}
+	if (kinds.empty() || kinds.back() < H_ESP) {
+		kinds.push_back(H_TCP);
+		naddrs.push_back(0);
+	}
+
+	click_in6_addr src = IP6Address("2001:db8::1").in6_addr();
+	click_in6_addr dst = IP6Address("2001:db8::2").in6_addr();
+	click_in6_addr final_dst = dst;
+
+	Vector<unsigned char> v;
+	v.resize(sizeof(click_ip6), 0);
+	int upper = -1;
+	int jumbo = 0;		//offset of the jumbo payload length
+	for (int i = 0; i < kinds.size(); i++) {
+		int next = (i + 1 < kinds.size() ? header_kinds[kinds[i + 1]].proto : 59);
+		switch (kinds[i]) {
+		case H_HBH_PADN:
+		case H_DEST:
+			//PadN of 4 bytes
+			v.push_back(next); v.push_back(0);
+			v.push_back(1); v.push_back(4);
+			append_u32(v, 0);
+			break;
+		case H_HBH_RA:
+			//Router Alert (MLD) at 2n + 0, then PadN of 2 bytes
+			v.push_back(next); v.push_back(0);
+			v.push_back(5); v.push_back(2); append_u16(v, 0);
+			v.push_back(1); v.push_back(0);
+			break;
+		case H_HBH_JUMBO:
+			//Jumbo Payload at 4n + 2; the length is set once it is known
+			v.push_back(next); v.push_back(0);
+			v.push_back(194); v.push_back(4);
+			jumbo = v.size();
+			append_u32(v, 0);
+			break;
+		case H_RH0:
+			v.push_back(next); v.push_back(2 * naddrs[i]);
+			v.push_back(0); v.push_back(naddrs[i]);
+			append_u32(v, 0);
+			for (int a = 0; a < naddrs[i]; a++) {
+				final_dst = dst;
+				final_dst.s6_addr[15] = 0x10 + a;
+				append(v, &final_dst, sizeof(final_dst));
+			}
+			break;
+		case H_FRAG:
+			//offset 0, more fragments
+			v.push_back(next); v.push_back(0);
+			append_u16(v, 1);
+			append_u32(v, 0x12345678);
+			break;
+		case H_ESP:
+			append_u32(v, 0x100);		//SPI
+			append_u32(v, 1);			//sequence number
+			upper = -1;
+			break;
+		case H_TCP:
+			upper = v.size();
+			append_u16(v, 12345); append_u16(v, 80);
+			append_u32(v, 1); append_u32(v, 0);
+			append_u16(v, 0x5010);		//data offset 5, ACK
+			append_u16(v, 8192);
+			append_u32(v, 0);			//checksum, urgent pointer
+			break;
+		case H_UDP:
+			upper = v.size();
+			append_u16(v, 12345); append_u16(v, 53);
+			append_u32(v, 0);			//length, checksum
+			break;
+		case H_ICMP:
+			upper = v.size();
+			v.push_back(128); v.push_back(0);	//echo request
+			append_u16(v, 0);
+			append_u32(v, 0x00010001);
+			break;
+		}
+	}
+	for (uint32_t i = 0; i < _payload; i++) {
+		v.push_back(i);
+	}
+
+	uint32_t plen = v.size() - sizeof(click_ip6);
+	if (plen > 0xFFFF && !jumbo) {
+		errh->error("packet too long without hbh-jumbo");
+		return 0;
+	} else if (plen <= 0xFFFF && jumbo) {
+		//IP6HopByHop would reject the jumbogram (RFC 2675)
+		errh->error("hbh-jumbo needs more than 65535 bytes of payload");
+		return 0;
+	}
+	WritablePacket *p = Packet::make(v.data(), v.size());
+	if (!p) {
+		errh->error("out of memory");
+		return 0;
+	}
+	unsigned char *data = p->data();
+	click_ip6 *ip = reinterpret_cast<click_ip6 *>(data);
+	ip->ip6_flow = htonl(0x60000000);
+	ip->ip6_plen = htons(jumbo ? 0 : plen);
+	ip->ip6_nxt = header_kinds[kinds[0]].proto;
+	ip->ip6_hlim = 64;
+	ip->ip6_src = src;
+	ip->ip6_dst = dst;
+	if (jumbo) {
+		uint32_t j = htonl(plen);
+		memcpy(data + jumbo, &j, 4);
+	}
+	if (upper >= 0) {
+		uint32_t ulen = v.size() - upper;
+		int proto = header_kinds[kinds.back()].proto;
+		int cksum_at = (proto == 6 ? 16 : proto == 17 ? 6 : 2);
+		if (proto == 17) {
+			//0 in a jumbogram (RFC 2675)
+			uint16_t l = htons(ulen > 0xFFFF ? 0 : ulen);
+			memcpy(data + upper + 4, &l, 2);
+		}
+		//the pseudo header names the final destination; its length has
+		//32 bits, the high 16 of which are summed with the data
+		uint64_t sum = in6_cksum_add(data + upper, ulen, htons(ulen >> 16));
+		uint16_t c = in6_cksum_finish(&src, &final_dst, htons(ulen & 0xFFFF), proto, sum);
+		memcpy(data + upper + cksum_at, &c, 2);
+	}
+	return p;
+}
+
+int
+IP6ExtBench::write_run(const String &s, Element *e, void *, ErrorHandler *errh)
+{
+	IP6ExtBench *b = static_cast<IP6ExtBench *>(e);
+	String chain = cp_uncomment(s);
+	if (!chain) {
+		chain = b->_chain;
+	}
+	WritablePacket *tmpl = b->make_packet(chain, errh);
+	if (!tmpl) {
+		return -1;
+	}
+	const unsigned char *data = tmpl->data();
+	uint32_t len = tmpl->length();
+	uint32_t n = b->_count;
+
+	//warm the caches and the packet pool
+	for (uint32_t i = 0; i < n / 10 + 1; i++) {
+		if (Packet *p = Packet::make(data, len)) {
+			b->output(0).push(p);
+		}
+	}
+
+	//making and freeing the copies alone
+#if CLICK_DMALLOC
+	size_t allocs0 = click_dmalloc_totalnew;
+#endif
+	Timestamp t0 = Timestamp::now_steady();
+	click_cycles_t c0 = click_get_cycles();
+	for (uint32_t i = 0; i < n; i++) {
+		if (Packet *p = Packet::make(data, len)) {
+			p->kill();
+		}
+	}
+	click_cycles_t c1 = click_get_cycles();
+	Timestamp t1 = Timestamp::now_steady();
+#if CLICK_DMALLOC
+	size_t allocs1 = click_dmalloc_totalnew;
+#endif
+	for (uint32_t i = 0; i < n; i++) {
+		if (Packet *p = Packet::make(data, len)) {
+			b->output(0).push(p);
+		}
+	}
+	click_cycles_t c2 = click_get_cycles();
+	Timestamp t2 = Timestamp::now_steady();
+#if CLICK_DMALLOC
+	size_t allocs2 = click_dmalloc_totalnew;
+#endif
+	tmpl->kill();
+
+	double baseline_ns = (double) (t1 - t0).nsecval() / n;
+	double ns = (double) (t2 - t1).nsecval() / n - baseline_ns;
+	double cycles = ((double) (c2 - c1) - (double) (c1 - c0)) / n;
+	if (ns <= 0) {
+		ns = 0.001;
+	}
+	StringAccum sa;
+	sa << "{\"bench\": \"" << b->name() << "\", \"chain\": \"" << chain
+	   << "\", \"length\": " << len << ", \"packets\": " << n;
+	sa.snprintf(160, ", \"ns_per_packet\": %.2f, \"mpps\": %.3f, \"cycles_per_packet\": %.1f, \"baseline_ns_per_packet\": %.2f",
+		    ns, 1000 / ns, cycles, baseline_ns);
+#if CLICK_DMALLOC
+	sa.snprintf(64, ", \"allocs_per_packet\": %.2f}", (double) ((allocs2 - allocs1) - (allocs1 - allocs0)) / n);
+#else
+	sa << ", \"allocs_per_packet\": null}";
+#endif
+	b->_result = sa.take_string();
+	return 0;
+}
+
+String
+IP6ExtBench::read_result(Element *e, void *)
+{
+	return static_cast<IP6ExtBench *>(e)->_result;
+}
+
+void
+IP6ExtBench::add_handlers()
+{
+	add_write_handler("run", write_run, 0);
+	add_read_handler("result", read_result, 0);
+}
+
+CLICK_ENDDECLS
+ELEMENT_REQUIRES(userlevel IP6Cksum)
+EXPORT_ELEMENT(IP6ExtBench)
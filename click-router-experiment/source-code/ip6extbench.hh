@@ -0,0 +1,118 @@
+#ifndef CLICK_IP6EXTBENCH_HH
+#define CLICK_IP6EXTBENCH_HH
+#include <click/element.hh>
+#include <click/glue.hh>
+CLICK_DECLS
+
+/*
+ * =c
+ * IP6ExtBench([CHAIN, I<keywords> COUNT, PAYLOAD])
+ * =s ip6
+ *
+ * =d
+ *
+ * Userlevel microbenchmark of the element connected to its output. Writing
+ * the C<run> handler builds an IP6 packet with the extension header chain
+ * CHAIN, then pushes COUNT fresh copies of it downstream in a tight loop,
+ * timing the loop. It also times a loop that only makes and frees the copies,
+ * and reports the difference as the cost of the elements downstream.
+ *
+ * CHAIN is a space-separated list of headers, in order, from:
+ *
+ * =over 8
+ *
+ * =item C<hbh-padn>, C<hbh-ra>, C<hbh-jumbo>
+ *
+ * Hop-by-hop header of 8 bytes holding a PadN option, a Router Alert option,
+ * or a Jumbo Payload option (the payload length field of the IP6 header is
+ * then 0). A chain with C<hbh-jumbo> must carry more than 65535 bytes after
+ * the IP6 header, as RFC 2675 requires of jumbograms.
+ *
+ * =item C<dest>
+ *
+ * Destination options header of 8 bytes holding a PadN option.
+ *
+ * =item C<rh0:>I<N>
+ *
+ * Type 0 routing header with N addresses, 1 to 23, all segments left.
+ *
+ * =item C<frag>
+ *
+ * Fragment header of a first fragment.
+ *
+ * =item C<esp>
+ *
+ * ESP header; what follows is opaque.
+ *
+ * =item C<tcp>, C<udp>, C<icmp>
+ *
+ * Upper layer header, with its checksum. C<tcp> is added if the chain does
+ * not end with one of these or C<esp>. The TCP header has the ACK flag
+ * set. Past 65535 bytes of payload, which takes C<hbh-jumbo>, the UDP length
+ * is 0 as in RFC 2675.
+ *
+ * =back
+ *
+ * Default CHAIN is C<tcp>.
+ *
+ * Keyword arguments are:
+ *
+ * =over 8
+ *
+ * =item COUNT
+ *
+ * Unsigned integer. Packets pushed per run. Default is 1000000.
+ *
+ * =item PAYLOAD
+ *
+ * Unsigned integer. Bytes of data after the last header. Default is 64.
+ *
+ * =back
+ *
+ * =h run write-only
+ *
+ * Runs the benchmark, with the chain written if it is not empty.
+ *
+ * =h result read-only
+ *
+ * Result of the last run, as one line of JSON: the bench name (the element's
+ * name), chain, packet length, packets, then ns_per_packet, mpps and
+ * cycles_per_packet for the elements downstream, baseline_ns_per_packet for
+ * making and freeing a copy, and allocs_per_packet. Allocations are only
+ * counted by builds with --enable-dmalloc; otherwise allocs_per_packet is
+ * null.
+ *
+ * =e
+ *
+ *   b :: IP6ExtBench(COUNT 2000000) -> IP6HopByHop -> Discard;
+ *   Script(write b.run hbh-ra tcp, print $(b.result), stop);
+ *
+ * =a IP6HopByHop, IP6Routing, IP6Fragmenter, IP6Classifier */
+
+class IP6ExtBench : public Element {
+
+  String _chain;
+  uint32_t _count;
+  uint32_t _payload;
+  String _result;
+
+  WritablePacket *make_packet(const String &chain, ErrorHandler *errh);
+  static int write_run(const String &s, Element *e, void *thunk, ErrorHandler *errh);
+  static String read_result(Element *e, void *thunk);
+
+ public:
+
+  IP6ExtBench();
+  ~IP6ExtBench();
+
+  const char *class_name() const		{ return "IP6ExtBench"; }
+  const char *port_count() const		{ return PORTS_0_1; }
+  const char *processing() const		{ return PUSH; }
+  int configure(Vector<String> &, ErrorHandler *);
+
+  void add_handlers();
+
+};
+
+CLICK_ENDDECLS
+#endif
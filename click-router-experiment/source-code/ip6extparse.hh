@@ -0,0 +1,265 @@
+#ifndef CLICK_IP6EXTPARSE_HH
+#define CLICK_IP6EXTPARSE_HH
+#include <click/packet.hh>
+#include <clicknet/ip6.h>
+CLICK_DECLS
+
+/*
+ * Shared walk of the IP6 extension header chain.
+ *
+ * The first element that needs the chain of a packet walks it once with
+ * ip6_ext_get(), which records the positions it found in the packet's
+ * annotations. Every later element calling ip6_ext_get() on that packet reads
+ * them back instead of walking the chain again. Offsets are counted from the
+ * start of the IP6 header, so they stay valid whatever encapsulation is in
+ * front of it; elements that insert or remove extension headers must call
+ * ip6_ext_clear() on the packets they emit.
+ *
+ * The annotation takes IP6EXT_ANNO_SIZE bytes from IP6EXT_ANNO_OFFSET. Define
+ * IP6EXT_ANNO_OFFSET before including this file if those bytes are used by
+ * other annotations in the configuration.
+ */
+
+#if __cplusplus >= 201103L	/*the table below is then built by the compiler*/
+# define IP6EXT_CONSTEXPR constexpr
+#else
+# define IP6EXT_CONSTEXPR const
+#endif
+
+#ifndef IP6EXT_ANNO_OFFSET
+# define IP6EXT_ANNO_OFFSET	32
+#endif
+#define IP6EXT_ANNO_SIZE	14
+
+/*
+ * Class of each Next Header value, and how the length of such a header is
+ * found: ((length byte & mask) + add) << shift. Adding a header type takes
+ * one line in ip6_ext_classify().
+ */
+enum{
+	IP6EXT_L4 = 0,			//upper layer header, ends the walk
+	IP6EXT_UNKNOWN,			//ESP, No Next Header or unknown, ends the walk
+	IP6EXT_LEN8,			//length byte in 8-octet units, first 8 octets excluded
+	IP6EXT_FIXED,			//8 octets whatever the length byte (Fragment)
+	IP6EXT_AH,				//length byte in 4-octet units, first 8 octets excluded
+	IP6EXT_CLASS_MASK = 0x0F,
+	IP6EXT_UNFRAGMENTABLE = 0x10	//part of the unfragmentable part when leading
+};
+
+static const uint8_t ip6_ext_length_mask[] = { 0, 0, 0xFF, 0, 0xFF };
+static const uint8_t ip6_ext_length_add[] = { 0, 0, 1, 1, 2 };
+static const uint8_t ip6_ext_length_shift[] = { 0, 0, 3, 3, 2 };
+
+static inline IP6EXT_CONSTEXPR uint8_t
+ip6_ext_classify(int next){
+	return (next == 0 || next == 43 || next == 60 ? IP6EXT_LEN8 | IP6EXT_UNFRAGMENTABLE	//HBH, routing, destination
+			: next == 135 || next == 139 || next == 140 ? IP6EXT_LEN8	//Mobility, HIP, Shim6
+			: next == 253 || next == 254 ? IP6EXT_LEN8			//experimentation (RFC 3692)
+			: next == 44 ? IP6EXT_FIXED
+			: next == 51 ? IP6EXT_AH
+			: next == 6 || next == 17 || next == 58 ? IP6EXT_L4	//TCP, UDP, ICMP6
+			: next == 33 || next == 132 || next == 136 ? IP6EXT_L4	//DCCP, SCTP, UDP-Lite
+			: IP6EXT_UNKNOWN);
+}
+
+#define IP6EXT_CLASS4(n)	ip6_ext_classify(n), ip6_ext_classify((n) + 1), ip6_ext_classify((n) + 2), ip6_ext_classify((n) + 3)
+#define IP6EXT_CLASS16(n)	IP6EXT_CLASS4(n), IP6EXT_CLASS4((n) + 4), IP6EXT_CLASS4((n) + 8), IP6EXT_CLASS4((n) + 12)
+#define IP6EXT_CLASS64(n)	IP6EXT_CLASS16(n), IP6EXT_CLASS16((n) + 16), IP6EXT_CLASS16((n) + 32), IP6EXT_CLASS16((n) + 48)
+
+/*Class of every Next Header value, computed by the compiler*/
+static IP6EXT_CONSTEXPR uint8_t ip6_ext_class[256] = {
+	IP6EXT_CLASS64(0), IP6EXT_CLASS64(64), IP6EXT_CLASS64(128), IP6EXT_CLASS64(192)
+};
+
+/*Positions of the headers of one packet, from the start of its IP6 header*/
+struct ip6_ext_info{
+	enum{
+		F_PARSED = 1,			//the annotation holds a walked chain
+		F_TRUNCATED = 2,		//a header runs past the end of the packet or past 0xFFFF
+		F_LATER_FRAGMENT = 4	//non-first fragment: no upper layer header
+	};
+	uint16_t hbh;			//hop-by-hop header, 0 if absent
+	uint16_t routing;		//first routing header, 0 if absent
+	uint16_t frag;			//fragment header, 0 if absent
+	uint16_t l4;			//first header not walked, 0 if unknown
+	uint16_t unfrag_len;	//length of the unfragmentable part, IP6 header included
+	uint16_t unfrag_nxt;	//offset of the Next Header field closing the unfragmentable part
+	uint8_t proto;			//Next Header value of the header at l4
+	uint8_t flags;
+};
+
+/*
+ * Walks the chain of the IP6 header at ip, of which length bytes are present.
+ * The walk stops at the first upper layer header, ESP (whose payload is
+ * encrypted), No Next Header, an unknown header or a non-first fragment;
+ * proto and l4 then name that header. The unfragmentable part holds the
+ * hop-by-hop, destination and routing headers in front of any other. Every
+ * header is stepped over the same way, driven by ip6_ext_class. Offsets are
+ * kept in 16 bits, so a jumbogram whose chain runs past 0xFFFF bytes is
+ * reported as truncated, with the positions found below that.
+ */
+inline void
+ip6_ext_parse(const unsigned char *ip, int length, ip6_ext_info &info){
+	int pace = sizeof(click_ip6);
+	int next = reinterpret_cast<const click_ip6 *>(ip)->ip6_nxt;
+	bool unfragmentable = true;
+
+	memset(&info, 0, sizeof(info));
+	info.unfrag_len = pace;
+	info.unfrag_nxt = 6;		//Next Header field of the IP6 header
+	info.flags = ip6_ext_info::F_PARSED;
+
+	while (pace + 8 <= length) {
+		const click_ip6_header_ext *header = reinterpret_cast<const click_ip6_header_ext *>(ip + pace);
+		uint8_t type = ip6_ext_class[next];
+		int cls = type & IP6EXT_CLASS_MASK;
+		if (cls <= IP6EXT_UNKNOWN) {
+			//upper layer header, ESP, no next header or unknown
+			info.l4 = pace;
+			info.proto = next;
+			return;
+		}
+		int header_length = ((header->ip6_header_extension._header_length & ip6_ext_length_mask[cls])
+							 + ip6_ext_length_add[cls]) << ip6_ext_length_shift[cls];
+		if (pace + header_length > 0xFFFF) {
+			//the headers behind this one are out of reach of the offsets
+			info.proto = next;
+			info.flags |= ip6_ext_info::F_TRUNCATED;
+			return;
+		}
+		unfragmentable &= (type & IP6EXT_UNFRAGMENTABLE) != 0;
+		if (unfragmentable) {
+			info.unfrag_nxt = pace;
+			info.unfrag_len = pace + header_length;
+		}
+		if (next == 0 && pace == sizeof(click_ip6)) {
+			//Hop by Hop header, only valid right after the IP6 header
+			info.hbh = pace;
+		} else if (next == 43 && !info.routing) {
+			info.routing = pace;
+		} else if (next == 44) {
+			info.frag = pace;
+			if (ntohs(header->ip6_frag._frag_offset_flag) & 0xFFF8) {
+				//only the first fragment carries the headers that follow
+				info.proto = header->ip6_frag._frag_nxt_header;
+				info.flags |= ip6_ext_info::F_LATER_FRAGMENT;
+				return;
+			}
+		}
+		next = header->ip6_header_extension._nxt_header;
+		pace += header_length;
+	}
+	info.proto = next;
+	if (pace <= length) {
+		info.l4 = pace;		//present, but shorter than 8 bytes
+	} else {
+		info.flags |= ip6_ext_info::F_TRUNCATED;
+	}
+}
+
+inline void
+ip6_ext_store(Packet *p, const ip6_ext_info &info){
+	p->set_anno_u16(IP6EXT_ANNO_OFFSET, info.hbh);
+	p->set_anno_u16(IP6EXT_ANNO_OFFSET + 2, info.routing);
+	p->set_anno_u16(IP6EXT_ANNO_OFFSET + 4, info.frag);
+	p->set_anno_u16(IP6EXT_ANNO_OFFSET + 6, info.l4);
+	p->set_anno_u16(IP6EXT_ANNO_OFFSET + 8, info.unfrag_len);
+	p->set_anno_u16(IP6EXT_ANNO_OFFSET + 10, info.unfrag_nxt);
+	p->set_anno_u8(IP6EXT_ANNO_OFFSET + 12, info.proto);
+	p->set_anno_u8(IP6EXT_ANNO_OFFSET + 13, info.flags);
+}
+
+/*Forgets the chain recorded for p, after its headers were changed*/
+inline void
+ip6_ext_clear(Packet *p){
+	p->set_anno_u16(IP6EXT_ANNO_OFFSET + 8, 0);
+}
+
+/*Returns the chain recorded for p, walking and recording it if needed.
+ * ip_offset is the position of the IP6 header in the packet data*/
+inline void
+ip6_ext_get(Packet *p, int ip_offset, ip6_ext_info &info){
+	//unfrag_len is at least 40 once the chain was walked
+	if (p->anno_u16(IP6EXT_ANNO_OFFSET + 8) != 0) {
+		info.hbh = p->anno_u16(IP6EXT_ANNO_OFFSET);
+		info.routing = p->anno_u16(IP6EXT_ANNO_OFFSET + 2);
+		info.frag = p->anno_u16(IP6EXT_ANNO_OFFSET + 4);
+		info.l4 = p->anno_u16(IP6EXT_ANNO_OFFSET + 6);
+		info.unfrag_len = p->anno_u16(IP6EXT_ANNO_OFFSET + 8);
+		info.unfrag_nxt = p->anno_u16(IP6EXT_ANNO_OFFSET + 10);
+		info.proto = p->anno_u8(IP6EXT_ANNO_OFFSET + 12);
+		info.flags = p->anno_u8(IP6EXT_ANNO_OFFSET + 13);
+		return;
+	}
+	ip6_ext_parse(p->data() + ip_offset, p->length() - ip_offset, info);
+	ip6_ext_store(p, info);
+}
+
+/*Offset from ip of the Jumbo Payload option of the hop-by-hop header of
+ * info, or 0 if it holds none. length bytes are present at ip*/
+inline int
+ip6_jumbo_option(const unsigned char *ip, int length, const ip6_ext_info &info){
+	if (!info.hbh || info.hbh + 2 > length) {
+		return 0;
+	}
+	int end = info.hbh + (ip[info.hbh + 1] + 1) * 8;
+	if (end > length) {
+		end = length;
+	}
+	int i = info.hbh + 2;
+	while (i + 2 <= end) {
+		if (ip[i] == 0) {			//Pad1
+			i++;
+			continue;
+		}
+		if (ip[i] == 194 && ip[i + 1] == 4 && i + 6 <= end) {
+			return i;
+		}
+		i += ip[i + 1] + 2;
+	}
+	return 0;
+}
+
+/*Payload length of the IP6 packet at ip: ip6_plen, or the length of its
+ * Jumbo Payload option (RFC 2675) when ip6_plen is 0. jumbo is the offset of
+ * that option, from ip6_jumbo_option()*/
+inline uint32_t
+ip6_payload_length(const unsigned char *ip, int jumbo){
+	uint16_t plen = reinterpret_cast<const click_ip6 *>(ip)->ip6_plen;
+	if (plen != 0 || !jumbo) {
+		return ntohs(plen);
+	}
+	uint32_t j;
+	memcpy(&j, ip + jumbo + 2, 4);
+	return ntohl(j);
+}
+
+/*Turns the Jumbo Payload option at offset jumbo into a PadN option of the
+ * same length, for a packet cut down below 65536 bytes of payload. The
+ * header chain keeps its layout*/
+inline void
+ip6_jumbo_clear(unsigned char *ip, int jumbo){
+	ip[jumbo] = 1;
+	memset(ip + jumbo + 2, 0, 4);
+}
+
+/*Destination of the upper layer pseudo header of the packet whose chain is
+ * info: the final one of a routing header with segments left, else the
+ * destination of the IP6 header*/
+inline const click_in6_addr *
+ip6_final_destination(const unsigned char *ip, const ip6_ext_info &info){
+	const unsigned char *rh = ip + info.routing;
+	if (info.routing && rh[3] != 0) {
+		int naddr = rh[1] / 2;
+		if ((rh[2] == 0 || rh[2] == 2) && naddr > 0) {
+			return reinterpret_cast<const click_in6_addr *>(rh + 8 + 16 * (naddr - 1));
+		} else if (rh[2] == 4 && naddr > 0) {
+			//the segment list of an SRH is in reverse order
+			return reinterpret_cast<const click_in6_addr *>(rh + 8);
+		}
+	}
+	return &reinterpret_cast<const click_ip6 *>(ip)->ip6_dst;
+}
+
+CLICK_ENDDECLS
+#endif
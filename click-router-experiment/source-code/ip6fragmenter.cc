@@ -17,21 +17,27 @@
 
 #include <click/config.h>
 #include "ip6fragmenter.hh"
+#include "ip6extparse.hh"
 #include <clicknet/ip6.h>
+#include <clicknet/udp.h>
 #include <click/args.hh>
 #include <click/error.hh>
 #include <click/glue.hh>
 CLICK_DECLS
 
 IP6Fragmenter::IP6Fragmenter()
-  : _drops(0)
 {
   _fragments = 0;
+  _udp_segment = 0;
+  _udp_segments = 0;
   _mtu = 0;
+  _pool = 0;
 }
 
 IP6Fragmenter::~IP6Fragmenter()
 {
+  if (_pool)
+    _pool->orphan();
 }
 
 
@@ -40,162 +46,345 @@ IP6Fragmenter::configure(Vector<String> &conf, ErrorHandler *errh)
 {
     //return Args(conf, this, errh).read_mp("MTU", _mtu).complete();
     _headroom = Packet::default_headroom;
+    uint32_t pool = 256;
+    if (_pmtu.configure(conf, this, errh) < 0)
+	return -1;
     if (Args(conf, this, errh)
 	.read_mp("MTU", _mtu)
+	.read("UDP_SEGMENT", _udp_segment)
+	.read("POOL", pool)
 	.complete() < 0)
 	return -1;
     if (_mtu < 8)
 	return errh->error("MTU must be at least 8");
+    if (_udp_segment > 65527)
+	return errh->error("UDP_SEGMENT must be at most 65527");
+    _pool = new IP6FragPool(_headroom + _mtu, pool);
+    _stats.configure(noutputs());
     return 0;
 }
 
+/*Writes the fragment header at frag, for the data at offset bytes into the
+ * fragmentable part*/
+static inline void
+set_frag_header(unsigned char *frag, int nxt, int offset, bool more, uint32_t id){
+	click_ip6_header_ext *frag_ext = reinterpret_cast <click_ip6_header_ext *>(frag);
+	frag_ext->ip6_frag._frag_nxt_header = nxt;
+	frag_ext->ip6_frag._frag_reserved = 0;
+	//offset in 8-byte units in the high 13 bits, so offset itself; M flag last
+	frag_ext->ip6_frag._frag_offset_flag = htons(offset | (more ? 1 : 0));
+	frag_ext->ip6_frag._frag_id = id;
+}
+
+/*Makes the fragment of p holding dlen bytes at offset into the fragmentable
+ * part; only the headers and that slice are copied*/
+WritablePacket *
+IP6Fragmenter::make_fragment(Packet *p, const ip6_ext_info &info, int offset, int dlen, bool more, uint32_t id){
+	int unfragmentable_len = info.unfrag_len;
+	WritablePacket *q = _pool->make(_headroom, unfragmentable_len + FRAG_HDR_LEN + dlen);
+	if (!q) {
+		return 0;
+	}
+	unsigned char *d = q->data();
+	memcpy(d, p->data(), unfragmentable_len);
+	d[info.unfrag_nxt] = 44;
+	set_frag_header(d + unfragmentable_len, p->data()[info.unfrag_nxt], offset, more, id);
+	memcpy(d + unfragmentable_len + FRAG_HDR_LEN, p->data() + unfragmentable_len + offset, dlen);
+	reinterpret_cast <click_ip6 *>(d)->ip6_plen = htons(unfragmentable_len + FRAG_HDR_LEN + dlen - sizeof(click_ip6));
+	q->set_network_header(d, sizeof(click_ip6));
+	q->copy_annotations(p);
+	ip6_ext_clear(q);
+	return q;
+}
+
 void
 IP6Fragmenter::fragment(Packet *p_in){
 
-	//find the length of unfragmentable part
-	//including ip6 header, Hop by Hop, Destination and Routing Header Extension
-	int _offset = 0;
 	const click_ip6 *ip_in = reinterpret_cast <const click_ip6 *>( p_in->data());
-	if((htons(ip_in->ip6_plen) + sizeof(click_ip6)) <=_mtu){		//packet length is less than MTU no need to fragment
-		checked_output_push(0, p_in);
+	unsigned mtu = _pmtu.lookup(ip_in->ip6_dst, _mtu);
+	uint32_t plen = ntohs(ip_in->ip6_plen);
+	ip6_ext_info info;
+	int jumbo = 0;
+	if (plen == 0) {
+		//a jumbogram has its length in a hop by hop option (RFC 2675)
+		ip6_ext_get(p_in, 0, info);
+		jumbo = ip6_jumbo_option(p_in->data(), p_in->length(), info);
+		plen = ip6_payload_length(p_in->data(), jumbo);
+	}
+	if((plen + sizeof(click_ip6)) <= mtu){		//packet length is less than MTU no need to fragment
+		_stats.emit(this, 0, p_in, IP6DROP_NO_OUTPUT);
+		return;
+	}
+	if (jumbo) {
+		//fragment offsets stop at 65535 bytes, and RFC 2675 forbids a
+		//Fragment header in a jumbogram: it can only be segmented, before
+		_stats.emit(this, 1, p_in, IP6DROP_NO_OUTPUT);
+		return;
+	}
+	//fragments are copied from the payload the packet claims: it must hold it
+	if (plen + sizeof(click_ip6) > p_in->length()) {
+		_stats.emit(this, 1, p_in, IP6DROP_LENGTH_BAD);
+		return;
+	}
+	//the unfragmentable part is the IP6 header and the hop by hop,
+	//destination and routing headers that directly follow it
+	ip6_ext_get(p_in, 0, info);
+	int unfragmentable_len = info.unfrag_len;
+	int nxt = p_in->data()[info.unfrag_nxt];
+
+	//length of the fragmentable part
+	int in_dlen = plen + sizeof(click_ip6) - unfragmentable_len;
+
+	//data per fragment, in 8-byte units but the last
+	int out_dlen = (int) (mtu - FRAG_HDR_LEN - unfragmentable_len) & ~7;
+	if (in_dlen <= 0) {
+		//the headers run past the payload length
+		_stats.emit(this, 1, p_in, IP6DROP_LENGTH_BAD);
 		return;
 	}
-	const click_ip6_header_ext *header;
-	int unfragmentable_len = sizeof(click_ip6);	//initialize unfragment part equal to IP6 header length
-	int previous_hdr_pos = 6;		//The 7th byte in IPv6 main header is next header field
-	uint8_t header_length;	//header extension length
-	int cur_hdr_ext = ip_in->ip6_nxt;
-	//traverse through the unfragmentable part of the packet
-	bool loop_break = false;
-	while(!loop_break) {
-		  header = reinterpret_cast <const click_ip6_header_ext *>( p_in->data() + _offset + unfragmentable_len);
-		  switch(cur_hdr_ext){
-		  case 0:	//Hop by Hop Header
-			  header_length = header->ip6_hdr_length;
-			  previous_hdr_pos = unfragmentable_len;
-			  unfragmentable_len = unfragmentable_len + (header_length + 1) * 8;
-			  cur_hdr_ext = header->ip6_nxt_hdr;
-			  break;
-		  case 60: 	//Destination header
-			  header_length = header->ip6_hdr_length;
-			  previous_hdr_pos = unfragmentable_len;
-			  unfragmentable_len = unfragmentable_len + (header_length + 1) * 8;
-			  cur_hdr_ext = header->ip6_nxt_hdr;
-			  break;
-		  case 43:	//Routing Header
-			  header_length = header->ip6_hdr_length;
-			  previous_hdr_pos = unfragmentable_len;
-			  unfragmentable_len = unfragmentable_len + (header_length + 1) * 8;
-			  cur_hdr_ext = header->ip6_nxt_hdr;
-			  break;
-		  default:	//other header extension
-			  loop_break = true;
-			  break;
-		  }
-	  }
-
-
-	  //unfragmentable part includes IPv6 header
-	  int in_dlen = ntohs(ip_in->ip6_plen) + (sizeof(click_ip6) - unfragmentable_len);
-
-	  //add fragmentation header to every fragmeted packet
-	  //fragment offset is in unit of 8-byte block
-	  int out_dlen = (_mtu - 8 - unfragmentable_len) & ~7;	//fragment header size is 8
-
-	  //out put packet length field. Exclude ip6 header
-	  int out_plen = out_dlen + FRAG_HDR_LEN + unfragmentable_len - sizeof(click_ip6);	//fragment header size is 8
-
-	  //make packet writable
-	  WritablePacket *p = p_in->uniqueify();
-	  click_ip6 *ip = reinterpret_cast <click_ip6 *>(p->data());
-	  uint32_t unique_frag_id = click_random();
-	  bool last_frag = false;
-
-	  while(!last_frag){
-		  if(_offset + out_dlen >= in_dlen){		//if this is the last fragment
-			  last_frag = true;
-			  out_dlen = in_dlen - _offset;
-			  out_plen = out_dlen + unfragmentable_len + FRAG_HDR_LEN - sizeof(click_ip6);
-		  }
-
-		  WritablePacket *out_packet = Packet::make(_headroom, 0, out_dlen + unfragmentable_len + sizeof(click_ip6_header_ext), 0);
-
-		  /*
-		   * Fragment Offset field contains the offset of the data following
-		   * this header relative to the start of the fragmentable part of the original
-		   * packet (before fragmentation), in 8-octet (64-bit) units.
-		   */
-		  //copy unfragmentable part of original packet to all fragmented packets
-		  memcpy(out_packet->data(), p->data(), unfragmentable_len);
-
-		  //set IPv6 header of fragmented packet
-		  out_packet->set_network_header(out_packet->data(), sizeof(click_ip6));
-		  click_ip6 *t_ip = out_packet->ip6_header();
-		  t_ip->ip6_plen = htons(out_plen);
-
-		  //set the NextHeader field of last extension header in unfragmentable part to 44
-		  uint8_t *frag_hdr = new uint8_t(44);
-		  memcpy(out_packet->data() + previous_hdr_pos, frag_hdr, sizeof(uint8_t));
-
-		  //set fragmentation header for fragmented packets
-		  click_ip6_header_ext *frag_ext = reinterpret_cast <click_ip6_header_ext *>(out_packet->data() + unfragmentable_len);
-		  frag_ext->ip6_frag._frag_nxt_header = cur_hdr_ext;	//next header
-		  frag_ext->ip6_frag._frag_reserved = 0b00000000;		//reserved byte
-
-		  //set fragment offset
-		  frag_ext->ip6_frag._frag_offset_flag = _offset << 3;	//divide _offset by 8 (_offset << 3)
-		  frag_ext->ip6_frag._frag_offset_flag = frag_ext->ip6_frag._frag_offset_flag << 3;
-
-		  if(last_frag){	  //if last fragment, set more fragment flag to 0
-			  frag_ext->ip6_frag._frag_offset_flag = frag_ext->ip6_frag._frag_offset_flag & 0b1111111111111110;
-		  } else {			  //set more fragment flag to 1
-			  frag_ext->ip6_frag._frag_offset_flag = frag_ext->ip6_frag._frag_offset_flag | 0b0000000000000001;
-		  }
-
-		  //set reserved bits to 0
-		  frag_ext->ip6_frag._frag_offset_flag = frag_ext->ip6_frag._frag_offset_flag & 0b1111111111111001;
-
-		  //set fragmentation id - random number
-		  frag_ext->ip6_frag._frag_id = unique_frag_id;
-
-		  //move to offset of next fragmented packet
-		  _offset = _offset + out_dlen;
-
-		  memcpy(out_packet->data() + unfragmentable_len + sizeof(click_ip6_header_ext),
-				  p->data() + unfragmentable_len + _offset, out_dlen);
-
-		  checked_output_push(0, out_packet);
-	  }
-	  //bad header, discard packet
-	  p->kill();
+	if (out_dlen < 8) {
+		//the headers alone do not fit
+		_stats.emit(this, 1, p_in, IP6DROP_NO_OUTPUT);
+		return;
+	}
+	uint32_t unique_frag_id = click_random();
+
+	/*
+	 * A Click packet is a single buffer, so fragments cannot share the
+	 * payload of p_in: the headers of one would land on the data of the
+	 * one before. The other fragments are copied first; the first fragment
+	 * is then made in place of p_in, its headers moved back 8 bytes into
+	 * the headroom to open the fragment header, and its tail cut off.
+	 */
+	for (int offset = out_dlen; offset < in_dlen; offset += out_dlen) {
+		int dlen = in_dlen - offset < out_dlen ? in_dlen - offset : out_dlen;
+		WritablePacket *q = make_fragment(p_in, info, offset, dlen, offset + dlen < in_dlen, unique_frag_id);
+		if (!q) {
+			_stats.drop(p_in, IP6DROP_NO_MEMORY);
+			return;
+		}
+		_fragments++;
+		_stats.emit(this, 0, q, IP6DROP_NO_OUTPUT);
+	}
+
+	WritablePacket *p;
+	if (p_in->shared()) {
+		//uniqueify() would copy all of it
+		p = make_fragment(p_in, info, 0, out_dlen, true, unique_frag_id);
+		p_in->kill();
+	} else {
+		p = p_in->push(FRAG_HDR_LEN);
+		if (p) {
+			unsigned char *d = p->data();
+			memmove(d, d + FRAG_HDR_LEN, unfragmentable_len);
+			d[info.unfrag_nxt] = 44;
+			set_frag_header(d + unfragmentable_len, nxt, 0, true, unique_frag_id);
+			p->take(p->length() - (unfragmentable_len + FRAG_HDR_LEN + out_dlen));
+			reinterpret_cast <click_ip6 *>(d)->ip6_plen = htons(unfragmentable_len + FRAG_HDR_LEN + out_dlen - sizeof(click_ip6));
+			p->set_network_header(d, sizeof(click_ip6));
+			ip6_ext_clear(p);
+		}
+	}
+	if (!p) {
+		_stats.drop(IP6DROP_NO_MEMORY);
+		return;
+	}
+	_fragments++;
+	_stats.emit(this, 0, p, IP6DROP_NO_OUTPUT);
+}
+
+/*Copies the headers of p, its first hlen bytes, and dlen bytes of its data
+ * at offset*/
+WritablePacket *
+IP6Fragmenter::copy_datagram(Packet *p, int hlen, int offset, int dlen){
+	WritablePacket *q = _pool->make(_headroom, hlen + dlen);
+	if (!q) {
+		return 0;
+	}
+	memcpy(q->data(), p->data(), hlen);
+	memcpy(q->data() + hlen, p->data() + hlen + offset, dlen);
+	q->set_network_header(q->data(), sizeof(click_ip6));
+	q->copy_annotations(p);
+	return q;
+}
+
+/*Sets the payload and UDP lengths of q, whose UDP header is at l4 and which
+ * carries dlen bytes of payload, and its checksum. ports is the first word
+ * of the UDP header, as in memory. jumbo is the offset of the Jumbo Payload
+ * option of a jumbogram, cleared in q, or 0*/
+static void
+finish_udp(WritablePacket *q, int l4, int dlen, uint32_t ports, int jumbo,
+	   const click_in6_addr &src, const click_in6_addr &dst){
+	unsigned char *d = q->data();
+	if (jumbo) {
+		ip6_jumbo_clear(d, jumbo);
+	}
+	int ulen = sizeof(click_udp) + dlen;
+	reinterpret_cast<click_ip6 *>(d)->ip6_plen = htons(l4 + ulen - sizeof(click_ip6));
+	click_udp *uh = reinterpret_cast<click_udp *>(d + l4);
+	uh->uh_ulen = htons(ulen);
+	uh->uh_sum = 0;
+	uint32_t length_word;
+	memcpy(&length_word, &uh->uh_ulen, 4);
+	uint64_t sum = in6_cksum_add(d + l4 + sizeof(click_udp), dlen, (uint64_t) ports + length_word);
+	uint16_t cksum = in6_cksum_finish(&src, &dst, htons(ulen), 17, sum);
+	//a zero checksum is sent as all ones (RFC 8200)
+	uh->uh_sum = cksum ? cksum : 0xFFFF;
+}
+
+/*
+ * Splits a UDP datagram of more than _udp_segment bytes of payload into
+ * datagrams of _udp_segment bytes, and passes each to fragment(). As for
+ * fragments, the datagrams after the first are copied and chained first;
+ * the first one is then cut out of p itself and goes ahead of them.
+ */
+void
+IP6Fragmenter::segment_udp(Packet *p){
+	ip6_ext_info info;
+	ip6_ext_get(p, 0, info);
+	const unsigned char *data = p->data();
+	const click_ip6 *ip = reinterpret_cast <const click_ip6 *>(data);
+	int jumbo = ip->ip6_plen ? 0 : ip6_jumbo_option(data, p->length(), info);
+	uint32_t end = sizeof(click_ip6) + ip6_payload_length(data, jumbo);
+	int hlen = info.l4 + sizeof(click_udp);
+	if (info.proto != 17 || !info.l4 || info.frag || end > p->length() || hlen > (int) end
+	    || end - hlen <= _udp_segment || hlen - sizeof(click_ip6) + _udp_segment > 65535) {
+		fragment(p);
+		return;
+	}
+	//the UDP header is within the packet now; the UDP length of a
+	//jumbogram is 0 (RFC 2675)
+	uint32_t ulen = ntohs(reinterpret_cast <const click_udp *>(data + info.l4)->uh_ulen);
+	if (ulen == 0 && jumbo) {
+		ulen = end - info.l4;
+	}
+	if (ulen != end - info.l4) {
+		fragment(p);
+		return;
+	}
+	int dlen = end - hlen;
+	int seg = _udp_segment;
+	uint32_t ports;
+	memcpy(&ports, data + info.l4, 4);
+	click_in6_addr src = ip->ip6_src;
+	click_in6_addr dst = *ip6_final_destination(data, info);
+
+	Packet *head = 0, *last = 0;
+	WritablePacket *first = 0;
+	int offset;
+	for (offset = seg; offset < dlen; offset += seg) {
+		int len = dlen - offset < seg ? dlen - offset : seg;
+		WritablePacket *q = copy_datagram(p, hlen, offset, len);
+		if (!q) {
+			break;
+		}
+		finish_udp(q, info.l4, len, ports, jumbo, src, dst);
+		if (last) {
+			last->set_next(q);
+		} else {
+			head = q;
+		}
+		last = q;
+		q->set_next(0);
+	}
+	if (offset >= dlen) {
+		if (p->shared()) {
+			//uniqueify() would copy all of it
+			first = copy_datagram(p, hlen, 0, seg);
+			p->kill();
+		} else {
+			first = p->uniqueify();
+			first->take(first->length() - (hlen + seg));
+		}
+	} else {
+		p->kill();
+	}
+	if (!first) {
+		while (head) {
+			Packet *next = head->next();
+			head->kill();
+			head = next;
+		}
+		_stats.drop(IP6DROP_NO_MEMORY);
+		return;
+	}
+	finish_udp(first, info.l4, seg, ports, jumbo, src, dst);
+	_udp_segments++;
+	fragment(first);
+	while (head) {
+		Packet *next = head->next();
+		head->set_next(0);
+		_udp_segments++;
+		fragment(head);
+		head = next;
+	}
+}
+
+/*Learns the path MTU of a Packet Too Big message: the MTU field follows the
+ * type, code and checksum, and the quoted packet the MTU field*/
+void
+IP6Fragmenter::learn(Packet *p){
+	ip6_ext_info info;
+	ip6_ext_get(p, 0, info);
+	unsigned quote = info.l4 + 8;
+	if (info.proto != 58 || !info.l4 || (info.flags & ip6_ext_info::F_LATER_FRAGMENT)
+	    || p->length() < quote + sizeof(click_ip6) || p->data()[info.l4] != 2) {
+		_stats.drop(p, IP6DROP_PTB_BAD);
+		return;
+	}
+	uint32_t mtu;
+	memcpy(&mtu, p->data() + info.l4 + 4, 4);
+	const click_ip6 *invoking = reinterpret_cast <const click_ip6 *>(p->data() + quote);
+	if (!_pmtu.learn(invoking->ip6_dst, ntohl(mtu))) {
+		_stats.drop(p, IP6DROP_PTB_BAD);
+		return;
+	}
+	p->kill();
 }
 
 static String
-IP6Fragmenter_read_drops(Element *xf, void *)
+IP6Fragmenter_read_fragments(Element *xf, void *)
 {
   IP6Fragmenter *f = (IP6Fragmenter *)xf;
-  return String(f->drops());
+  return String(f->fragments());
 }
 
 static String
-IP6Fragmenter_read_fragments(Element *xf, void *)
+IP6Fragmenter_read_udp_segments(Element *xf, void *)
 {
   IP6Fragmenter *f = (IP6Fragmenter *)xf;
-  return String(f->fragments());
+  return String(f->udp_segments());
+}
+
+static String
+IP6Fragmenter_read_pool_allocations(Element *xf, void *)
+{
+  IP6Fragmenter *f = (IP6Fragmenter *)xf;
+  return String(f->pool_allocations());
 }
 
 void
 IP6Fragmenter::add_handlers()
 {
-  add_read_handler("drops", IP6Fragmenter_read_drops, 0);
   add_read_handler("fragments", IP6Fragmenter_read_fragments, 0);
+  add_read_handler("udp_segments", IP6Fragmenter_read_udp_segments, 0);
+  add_read_handler("pool_allocations", IP6Fragmenter_read_pool_allocations, 0);
+  _stats.add_handlers(this);
+  _pmtu.add_handlers(this);
 }
 
 
 void
-IP6Fragmenter::push(int, Packet *p) {
-  fragment(p);
+IP6Fragmenter::push(int port, Packet *p) {
+  _stats.profile_start();
+  if (port != 0)
+    learn(p);
+  else if (_udp_segment)
+    segment_udp(p);
+  else
+    fragment(p);
 }
 
 CLICK_ENDDECLS
+ELEMENT_REQUIRES(IP6Cksum)
 EXPORT_ELEMENT(IP6Fragmenter)
@@ -2,48 +2,144 @@
 #define CLICK_IP6FRAGMENTER_HH
 #include <click/element.hh>
 #include <click/glue.hh>
+#include "ip6stats.hh"
+#include "ip6extparse.hh"
+#include "ip6pmtu.hh"
+#include "ip6fragpool.hh"
 CLICK_DECLS
 
 /*
  * =c
- * IP6Fragmenter(MTU)
+ * IP6Fragmenter(MTU [, I<keywords> UDP_SEGMENT, POOL, PMTU_SIZE, PMTU_PREFIX, PMTU_AGING])
  * =s ip6
  *
  * =d
- * Expects IP6 packets as input.
+ * Expects IP6 packets on input 0.
  * If the IP6 packet size is <= mtu, just emits the packet on output 0.
- * If the size is greater than mtu and DF isn't set, splits into
- * fragments emitted on output 0.
- * If DF is set and size is greater than mtu, sends to output 1.
+ * If the size is greater than mtu, splits into fragments emitted on
+ * output 0. If even the unfragmentable part and the fragment header do
+ * not leave 8 bytes of data within mtu, sends the packet to output 1.
+ * Packets to fragment whose payload length runs past the end of the
+ * packet, or ends within the unfragmentable part, are sent to output 1 as
+ * well, and counted as length-bad drops if it is absent.
+ *
+ * Jumbograms (RFC 2675), whose length is in a Jumbo Payload option, are
+ * emitted on output 0 if they fit in mtu. They cannot be fragmented, so
+ * larger ones are sent to output 1, unless UDP_SEGMENT splits them first;
+ * TCP jumbograms are split by an IP6TCPSegmenter ahead.
  *
  * Ordinarily output 1 is connected to an ICMP6Error packet generator
- * with type 3 (UNREACH) and code 4 (NEEDFRAG).
+ * with type 2 (Packet Too Big).
+ *
+ * MTU is the MTU of the link. Input 1, if present, takes ICMP6 Packet Too
+ * Big messages, whose MTU is then kept for the prefix of the destination of
+ * the packet they quote, and used as mtu for the packets to that prefix
+ * (RFC 8201). An MTU is only ever lowered this way, and forgotten after
+ * PMTU_AGING seconds. Messages reporting less than 1280 bytes are dropped.
+ * Packet Too Big messages are consumed.
+ *
+ * With UDP_SEGMENT, UDP datagrams carrying more than UDP_SEGMENT bytes of
+ * payload, such as the send batches of QUIC or tunnels, are first split into
+ * datagrams of UDP_SEGMENT bytes, the last one excepted, instead of being
+ * fragmented. Each one carries the headers of the datagram and its own UDP
+ * length and checksum; the first one is the datagram itself, cut short.
+ * Datagrams still longer than mtu are then fragmented. A UDP jumbogram is
+ * split into ordinary datagrams, its Jumbo Payload option turned into
+ * padding, as long as the headers and UDP_SEGMENT bytes fit in 65535 bytes
+ * of payload.
+ *
+ * Fragments carry the annotations of the packet.
+ *
+ * Sends the first fragment last. The first fragment is the packet itself,
+ * with the fragment header opened in its headroom, so its data is not
+ * copied unless the packet is shared; the other fragments are copies of
+ * the headers and their slice of the data, in buffers of a pool: every
+ * thread keeps its own free buffers, and they are given back to it when the
+ * fragments are killed, so fragmenting does not call the allocator once
+ * enough buffers are in the pool.
+ *
+ * Keyword arguments are:
+ *
+ * =over 8
+ *
+ * =item UDP_SEGMENT
+ *
+ * Unsigned integer. Bytes of UDP payload per datagram when splitting larger
+ * UDP datagrams. Default is 0, which does not split them.
+ *
+ * =item POOL
+ *
+ * Unsigned integer. Fragment buffers, of MTU bytes plus headroom, allocated
+ * at configuration; more are allocated 32 at a time when needed. Default is
+ * 256.
+ *
+ * =item PMTU_SIZE
+ *
+ * Unsigned integer. Path MTUs kept, rounded up to a power of 2 no smaller
+ * than 4. 0 disables the cache. Default is 1024.
+ *
+ * =item PMTU_PREFIX
+ *
+ * Integer. Length of the destination prefixes path MTUs are kept for, 0 to
+ * 128. Default is 64.
+ *
+ * =item PMTU_AGING
+ *
+ * Unsigned integer. Seconds a path MTU is kept, 1 to 86400. Default is 600.
+ *
+ * =back
+ *
+ * =h fragments read-only
+ *
+ * Fragments emitted.
+ *
+ * =h udp_segments read-only
+ *
+ * Datagrams emitted by splitting UDP datagrams.
+ *
+ * =h pool_allocations read-only
+ *
+ * Allocations made by the fragment buffer pool, each for 32 buffers.
+ *
+ * =h pmtu read-only
+ *
+ * Path MTUs kept, one line per prefix: the prefix, the MTU and its age in
+ * seconds.
  *
- * Only the mac_broadcast annotation is copied into the fragments.
+ * =h pmtu_flush write-only
  *
- * Sends the first fragment last.
+ * Forgets the path MTUs.
  *
  * =e
  * Example:
  *
- *   ... -> fr::IP6Fragmenter -> Queue(20) -> ...
- *   fr[1] -> ICMP6Error(18.26.4.24, 3, 4) -> ...
+ *   ... -> fr::IP6Fragmenter(9000) -> Queue(20) -> ...
+ *   fr[1] -> ICMP6Error(2001:db8::1, 2, 0) -> ...
+ *   ... -> IP6Classifier(icmp type 2) -> [1]fr;
  *
- * =a ICMP6Error, CheckLength
+ * =a ICMP6Error, CheckLength, IP6TCPSegmenter
  */
 
 class IP6Fragmenter : public Element {
 
   unsigned _mtu;
   unsigned _headroom;
-  uint32_t _drops;
   uint32_t _fragments;
+  uint32_t _udp_segment;
+  uint64_t _udp_segments;
+  IP6Stats _stats;
+  IP6PMTU _pmtu;
+  IP6FragPool *_pool;
 
   enum{
 	  FRAG_HDR_LEN = 8	//fragmentation header is 8 bytes
   };
 
   void fragment(Packet *);
+  void learn(Packet *);
+  void segment_udp(Packet *);
+  WritablePacket *copy_datagram(Packet *p, int hlen, int offset, int dlen);
+  WritablePacket *make_fragment(Packet *p, const ip6_ext_info &info, int offset, int dlen, bool more, uint32_t id);
 
  public:
 
@@ -51,12 +147,14 @@ class IP6Fragmenter : public Element {
   ~IP6Fragmenter();
 
   const char *class_name() const		{ return "IP6Fragmenter"; }
-  const char *port_count() const		{ return PORTS_1_1X2; }
+  const char *port_count() const		{ return "1-2/1-2"; }
   const char *processing() const		{ return PUSH; }
   int configure(Vector<String> &, ErrorHandler *);
 
-  int drops() const				{ return _drops; }
+  uint64_t drops() const			{ return _stats.drops(); }
   int fragments() const				{ return _fragments; }
+  uint64_t udp_segments() const			{ return _udp_segments; }
+  uint64_t pool_allocations() const		{ return _pool->allocations(); }
 
   int unfragmentable_copy(click_ip6 *ip1, click_ip6 *ip2);
 
@@ -0,0 +1,149 @@
+#ifndef CLICK_IP6FRAGPOOL_HH
+#define CLICK_IP6FRAGPOOL_HH
+#include <click/packet.hh>
+#include <click/glue.hh>
+#include <click/sync.hh>
+#include <click/vector.hh>
+CLICK_DECLS
+
+/*
+ * Pool of the data buffers of IP6Fragmenter's fragments, all of one size.
+ *
+ * Click recycles data buffers of its default size only, so every fragment
+ * for a larger MTU costs a malloc and a free. Here every thread keeps a
+ * stack of free buffers: make() takes one, and the packet gives it back when
+ * killed, to the stack of the thread killing it. A stack grown to
+ * 2 * IP6POOL_BATCH buffers moves IP6POOL_BATCH of them to a shared depot,
+ * and an empty one takes as many back; only a depot running dry allocates,
+ * a slab of IP6POOL_BATCH buffers at a time. Once the slabs cover the
+ * fragments in flight, fragmenting calls no allocator.
+ *
+ * The pool is made with new and given up with orphan(). It counts a
+ * reference for its owner and one for every packet holding one of its
+ * buffers, and whichever drops the last one, orphan() or the destructor of
+ * the last such packet, frees it.
+ */
+
+enum{ IP6POOL_BATCH = 32 };		//buffers moved between a thread and the depot at once
+
+class IP6FragPool{ public:
+
+	/*Buffers of size bytes; prealloc of them are allocated at once*/
+	IP6FragPool(uint32_t size, uint32_t prealloc)
+		: _size((size + 63) & ~63), _refs(1), _allocations(0) {
+		_ncaches = click_max_cpu_ids();
+		_caches = new cache[_ncaches];
+		memset(_caches, 0, _ncaches * sizeof(cache));
+		_lock.acquire();
+		while ((uint32_t) _depot.size() < prealloc && grow()) {
+		}
+		_lock.release();
+	}
+
+	/*Drops the owner's reference*/
+	void orphan(){
+		unref();
+	}
+
+	/*A packet of length bytes after headroom bytes, in a buffer of the pool.
+	 * Its data is not initialized*/
+	inline WritablePacket *make(uint32_t headroom, uint32_t length){
+		if (headroom + length > _size) {
+			return Packet::make(headroom, 0, length, 0);
+		}
+		cache &c = _caches[click_current_cpu_id()];
+		if (c.count == 0 && !refill(c)) {
+			return 0;
+		}
+		unsigned char *buf = c.bufs[--c.count];
+		WritablePacket *p = Packet::make(buf + headroom, length, give_back, this,
+										 headroom, _size - headroom - length);
+		if (!p) {
+			c.bufs[c.count++] = buf;
+			return 0;
+		}
+		__atomic_add_fetch(&_refs, 1, __ATOMIC_RELAXED);
+		return p;
+	}
+
+	/*Slabs allocated, each holding IP6POOL_BATCH buffers*/
+	uint64_t allocations() const	{ return __atomic_load_n(&_allocations, __ATOMIC_RELAXED); }
+
+ private:
+
+	struct cache{
+		unsigned char *bufs[2 * IP6POOL_BATCH];
+		uint32_t count;
+		char padding[64];		//keeps caches of different threads off one cache line
+	};
+
+	cache *_caches;
+	unsigned _ncaches;
+	uint32_t _size;
+	Spinlock _lock;
+	Vector<unsigned char *> _depot;
+	Vector<unsigned char *> _slabs;
+	uint32_t _refs;			//the owner's, until orphan(), and one per packet
+	uint64_t _allocations;
+
+	~IP6FragPool(){
+		for (int i = 0; i < _slabs.size(); i++) {
+			delete[] _slabs[i];
+		}
+		delete[] _caches;
+	}
+
+	void unref(){
+		if (__atomic_sub_fetch(&_refs, 1, __ATOMIC_ACQ_REL) == 0) {
+			delete this;
+		}
+	}
+
+	/*Allocates a slab into the depot. Call with the lock held*/
+	bool grow(){
+		unsigned char *slab = new unsigned char[IP6POOL_BATCH * _size];
+		if (!slab) {
+			return false;
+		}
+		_slabs.push_back(slab);
+		//room for every buffer, so giving back never allocates
+		_depot.reserve(_slabs.size() * IP6POOL_BATCH);
+		for (int i = 0; i < IP6POOL_BATCH; i++) {
+			_depot.push_back(slab + i * _size);
+		}
+		__atomic_store_n(&_allocations, _allocations + 1, __ATOMIC_RELAXED);
+		return true;
+	}
+
+	bool refill(cache &c){
+		_lock.acquire();
+		if (_depot.size() < IP6POOL_BATCH && !grow()) {
+			_lock.release();
+			return false;
+		}
+		for (int i = 0; i < IP6POOL_BATCH; i++) {
+			c.bufs[c.count++] = _depot.back();
+			_depot.pop_back();
+		}
+		_lock.release();
+		return true;
+	}
+
+	static void give_back(unsigned char *buf, size_t, void *arg){
+		IP6FragPool *pool = static_cast<IP6FragPool *>(arg);
+		cache &c = pool->_caches[click_current_cpu_id()];
+		if (c.count == 2 * IP6POOL_BATCH) {
+			pool->_lock.acquire();
+			for (int i = 0; i < IP6POOL_BATCH; i++) {
+				pool->_depot.push_back(c.bufs[--c.count]);
+			}
+			pool->_lock.release();
+		}
+		c.bufs[c.count++] = buf;
+		pool->unref();
+	}
+
+};
+
+CLICK_ENDDECLS
+#endif
@@ -1,12 +1,13 @@
 
 #include <click/config.h>
 #include "ip6hopbyhop.hh"
+#include "ip6extparse.hh"
 #include <click/args.hh>
 #include <click/error.hh>
 #include <click/glue.hh>
 CLICK_DECLS
 
-IP6HopByHop::IP6HopByHop() : _drops(0) {
+IP6HopByHop::IP6HopByHop() {
 
 }
 
@@ -16,28 +17,40 @@ IP6HopByHop::~IP6HopByHop() {
 
 int
 IP6HopByHop::configure(Vector<String> &conf, ErrorHandler *errh) {
-    return 0;
+    if (_trace.configure(conf, this, errh) < 0)
+	return -1;
+    _stats.configure(noutputs());
+    return Args(conf, this, errh).complete();
 }
 
 int
-IP6HopByHop::checkingHopByHop(const click_ip6_header_ext *t_header){
+IP6HopByHop::checkingHopByHop(const click_ip6_header_ext *t_header, int length, uint32_t &jumbo_length){
 	/*
 	 * 1st byte is next header, 2nd byte is header length
 	 * so the beginning position of Hop by Hop option data is 3rd
 	 */
-	uint8_t index = 2;
+	int index = 2;
 	//convert header extension to an array of uint8_t
 	const uint8_t *header = reinterpret_cast<const uint8_t *>(t_header);
 	const uint8_t *opt_type, *opt_length;
 	const jumbo_option *jumbo_opt;
-	uint32_t jumbo_length;
 
 	int hdr_length = t_header->ip6_hdr_length;
 	//Hop By Hop header length in bytes
 	int hdr_length_in_bytes = (hdr_length + 1)*8;
+	//only length bytes of it are in the packet
+	if (hdr_length_in_bytes > length)
+		hdr_length_in_bytes = length;
 
-	while(index < hdr_length_in_bytes - 1) {
+	while(index < hdr_length_in_bytes) {
 		opt_type = reinterpret_cast <const uint8_t *>(header + index);
+		//every option but Pad1 has a length byte, and must end in the header
+		if (*opt_type != 0 && (index + 2 > hdr_length_in_bytes
+				       || index + 2 + header[index + 1] > hdr_length_in_bytes)) {
+			if (unlikely(_trace.enabled()))
+				_trace.record(IP6TRACE_HBH_TRUNCATED, index);
+			return -2;
+		}
 		opt_length = reinterpret_cast <const uint8_t *>(header + index + 1);
 
 		switch(*opt_type){
@@ -51,7 +64,8 @@ IP6HopByHop::checkingHopByHop(const click_ip6_header_ext *t_header){
 		case 5:			//Router Alert option
 			// if option length != 2 or not in alignment of 2n + 0
 			if ((*opt_length != 2) || ((index % 2) != 0)) {
-				click_chatter("Error. Router Alert option length must be 2 and in alignment of 2n + 0. \n");
+				if (unlikely(_trace.enabled()))
+					_trace.record(IP6TRACE_HBH_ROUTER_ALERT, *opt_length);
 			} else {
 				//Router Alert option is ok. Push to port 2
 				return 2;
@@ -62,28 +76,37 @@ IP6HopByHop::checkingHopByHop(const click_ip6_header_ext *t_header){
 		case 194:			//Jumbo payload option
 			jumbo_opt = reinterpret_cast <const jumbo_option *>(header + index);
 			if((index % 4) != 2) {
-				click_chatter("Error. Jumbo option must be in alignment of 4n + 2. \n");
+				if (unlikely(_trace.enabled()))
+					_trace.record(IP6TRACE_HBH_JUMBO_ALIGN, index);
 				//push to jumbo error port 3
 				return 3;
 			}
 			if (jumbo_opt->_j_o_length != 4) {
-				click_chatter("Error. Jumbo option length must be 4 bytes. \n");
+				if (unlikely(_trace.enabled()))
+					_trace.record(IP6TRACE_HBH_JUMBO_LENGTH, jumbo_opt->_j_o_length);
 				//push to jumbo error port 3
 				return 3;
 			}
 
-			jumbo_length = jumbo_opt->_j_length;
+			memcpy(&jumbo_length, jumbo_opt->_j_length, 4);
+			jumbo_length = ntohl(jumbo_length);
 			if(jumbo_length <= 65535){
-				click_chatter("Error. Jumbo packet payload is less than 65,535 bytes.\n");
+				if (unlikely(_trace.enabled()))
+					_trace.record(IP6TRACE_HBH_JUMBO_SHORT, jumbo_length);
 				//push to jumbo error port 3
 				return 3;
 			}
 			//Jumbo option is ok. Push to port 1
 			return 1;
 		default:
-			click_chatter("Unrecognized hop by hop option. %d \n", *opt_type);
-			//skip option and push packet to port 0
-			return 0;
+			if (unlikely(_trace.enabled()))
+				_trace.record(IP6TRACE_HBH_UNKNOWN_OPTION, *opt_type);
+			//the two high-order bits of the type say whether to skip the option
+			if (*opt_type & 0xC0) {
+				return -1;
+			}
+			index = index + *opt_length + 2;
+			break;
 		}
 	}
 	return 0;
@@ -92,7 +115,8 @@ IP6HopByHop::checkingHopByHop(const click_ip6_header_ext *t_header){
 
 void
 IP6HopByHop::add_handlers() {
-
+	_trace.add_handlers(this);
+	_stats.add_handlers(this);
 }
 
 void
@@ -100,46 +124,63 @@ IP6HopByHop::push(int, Packet *p) {
 	int _offset = 0;
 	int hll, out_port = 0;
 	uint16_t packet_length;
+	uint32_t jumbo_length = 0;
 	const click_ip6 *ip_in = reinterpret_cast <const click_ip6 *>( p->data() + _offset);
-	const click_ip6_header_ext *in_header;
-	int pace = sizeof(click_ip6);
-	uint8_t header_length;	//header extension length
-
-	uint8_t cur_hdr_ext = ip_in->ip6_nxt;
+	ip6_ext_info info;
 
+	_stats.profile_start();
 	//hop limit
 	hll = ip_in->ip6_hlim;
 	if(hll == 0){
 		//drop the packet
-		click_chatter("Hop limit is zero. Drop packet. \n");
+		if (unlikely(_trace.enabled()))
+			_trace.record(IP6TRACE_HLIM_ZERO, ntohs(ip_in->ip6_plen));
+		_stats.drop(p, IP6DROP_HLIM_ZERO);
+		return;
+	}
+
+	//the hop by hop header, if any, is the first extension header
+	ip6_ext_get(p, _offset, info);
+	if (!info.hbh) {
+		_stats.emit(this, 0, p, IP6DROP_NO_OUTPUT);
+		return;
+	}
+
+	if (info.flags & ip6_ext_info::F_TRUNCATED) {
+		if (unlikely(_trace.enabled()))
+			_trace.record(IP6TRACE_HBH_TRUNCATED, 0);
+		_stats.drop(p, IP6DROP_HBH_TRUNCATED);
 		return;
 	}
 
-	packet_length = htons(ip_in->ip6_plen);
-	while(true) {
-		  in_header = reinterpret_cast <const click_ip6_header_ext *>( p->data() + pace);
-
-		  switch(cur_hdr_ext){
-		  case 0:	//Hop by Hop Header
-			  header_length = in_header->ip6_hdr_length;
-			  pace = pace + (header_length + 1) * 8;
-			  cur_hdr_ext = in_header->ip6_nxt_hdr;
-			  out_port = checkingHopByHop(in_header);
-			  //if jumbo option and packet length is not zero ==> error
-			  if((out_port == 1) && (packet_length != 0)) {
-				  click_chatter("Error. For jumbo packet, packet length must be zero. \n");
-				  //push to error port 3
-				  out_port = 3;
-			  }
-
-			  checked_output_push(out_port, p);
-			  return;
-
-		  default:	//if Hop By Hop option does not exist
-			  checked_output_push(0, p);
-			  return;
-		  }
-	  }
+	packet_length = ntohs(ip_in->ip6_plen);
+	out_port = checkingHopByHop(reinterpret_cast <const click_ip6_header_ext *>( p->data() + _offset + info.hbh),
+				    p->length() - _offset - info.hbh, jumbo_length);
+	//a jumbogram must have a zero payload length, hold its whole jumbo
+	//length and no Fragment header (RFC 2675)
+	if (out_port == 1) {
+		if (packet_length != 0) {
+			if (unlikely(_trace.enabled()))
+				_trace.record(IP6TRACE_HBH_JUMBO_PLEN, packet_length);
+			out_port = 3;
+		} else if (jumbo_length > p->length() - _offset - sizeof(click_ip6)) {
+			if (unlikely(_trace.enabled()))
+				_trace.record(IP6TRACE_HBH_JUMBO_TRUNCATED, jumbo_length);
+			out_port = 3;
+		} else if (info.frag) {
+			if (unlikely(_trace.enabled()))
+				_trace.record(IP6TRACE_HBH_JUMBO_FRAG, info.frag);
+			out_port = 3;
+		}
+	}
+
+	if (out_port == -2) {
+		_stats.drop(p, IP6DROP_HBH_TRUNCATED);
+	} else if (out_port < 0) {
+		_stats.drop(p, IP6DROP_UNKNOWN_HEADER);
+	} else {
+		_stats.emit(this, out_port, p, out_port == 3 ? IP6DROP_BAD_JUMBO : IP6DROP_NO_OUTPUT);
+	}
 }
 
 CLICK_ENDDECLS
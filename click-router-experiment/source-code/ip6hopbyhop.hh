@@ -4,18 +4,21 @@
 #include <click/glue.hh>
 #include <clicknet/ip.h>
 #include <clicknet/ip6.h>
+#include "ip6trace.hh"
+#include "ip6stats.hh"
 CLICK_DECLS
 
 struct jumbo_option{
 	uint8_t _j_type;
 	uint8_t _j_o_length;
-	uint32_t _j_length;
+	uint8_t _j_length[4];	//at 4n + 2 in the packet: unaligned, in network byte order
 };
 
 
 class IP6HopByHop : public Element {
 
-	uint32_t _drops;
+	IP6Trace _trace;
+	IP6Stats _stats;
 
  public:
 
@@ -27,8 +30,8 @@ class IP6HopByHop : public Element {
   const char *processing() const		{ return PUSH; }
   int configure(Vector<String> &, ErrorHandler *);
 
-  int checkingHopByHop(const click_ip6_header_ext *t_header);
-  int drops() const				{ return _drops; }
+  int checkingHopByHop(const click_ip6_header_ext *t_header, int length, uint32_t &jumbo_length);
+  uint64_t drops() const			{ return _stats.drops(); }
 
   void add_handlers();
   void push(int, Packet *p);
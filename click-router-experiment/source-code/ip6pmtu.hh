@@ -0,0 +1,242 @@
+#ifndef CLICK_IP6PMTU_HH
+#define CLICK_IP6PMTU_HH
+#include <click/element.hh>
+#include <click/glue.hh>
+#include <click/args.hh>
+#include <click/confparse.hh>
+#include <click/straccum.hh>
+#include <click/sync.hh>
+#include <click/ip6address.hh>
+CLICK_DECLS
+
+/*
+ * Path MTU cache, filled by ICMP6 Packet Too Big messages (RFC 8201).
+ *
+ * The MTU learned for a destination is kept for its prefix, so the hosts
+ * behind one link share an entry. The table is split in sets of
+ * IP6PMTU_WAYS entries, two cache lines each, found by a hash of the prefix;
+ * a full set gives up its oldest entry. An entry is forgotten after the
+ * aging time, and the link MTU is tried again (RFC 8201 asks for at least
+ * 5 minutes, 10 being the default).
+ *
+ * Lookups take no lock. Every entry has a sequence number, odd while the
+ * entry is written, and a lookup that read an entry during a write ignores
+ * it; learning takes a lock against other learners.
+ *
+ * Elements add the keywords PMTU_SIZE, PMTU_PREFIX and PMTU_AGING with
+ * configure() and the handlers pmtu and pmtu_flush with add_handlers().
+ */
+
+enum{
+	IP6PMTU_WAYS = 4,		//entries per set
+	IP6PMTU_MIN = 1280		//IP6 minimum link MTU
+};
+
+class IP6PMTU{ public:
+
+	IP6PMTU() : _sets(0), _nsets(0), _prefix(64), _aging(600 * CLICK_HZ), _used(false) {}
+	~IP6PMTU()					{ delete[] _sets; }
+
+	/*Reads the PMTU_SIZE, PMTU_PREFIX and PMTU_AGING keywords from conf*/
+	int configure(Vector<String> &conf, Element *e, ErrorHandler *errh){
+		uint32_t size = 1024;
+		int prefix = 64;
+		uint32_t aging = 600;
+		if (Args(e, errh).bind(conf)
+			.read("PMTU_SIZE", size)
+			.read("PMTU_PREFIX", prefix)
+			.read("PMTU_AGING", aging)
+			.consume() < 0)
+			return -1;
+		if (prefix < 0 || prefix > 128) {
+			return errh->error("PMTU_PREFIX must be between 0 and 128");
+		}
+		if (aging == 0 || aging > 86400) {
+			return errh->error("PMTU_AGING must be between 1 and 86400");
+		}
+		_prefix = prefix;
+		memcpy(_mask, IP6Address::make_prefix(prefix).data(), 16);
+		_aging = aging * CLICK_HZ;
+		//sets of WAYS entries, a power of 2 of them; none disables the cache
+		uint32_t nsets = 0;
+		if (size) {
+			nsets = 1;
+			while (nsets * IP6PMTU_WAYS < size) {
+				nsets <<= 1;
+			}
+		}
+		delete[] _sets;
+		_sets = nsets ? new set[nsets] : 0;
+		_nsets = nsets;
+		if (_sets) {
+			memset(_sets, 0, nsets * sizeof(set));
+		}
+		_used = false;
+		return 0;
+	}
+
+	void add_handlers(Element *e){
+		e->add_read_handler("pmtu", dump_handler, this);
+		e->add_write_handler("pmtu_flush", flush_handler, this);
+	}
+
+	/*Path MTU to dst, or mtu if no smaller one was learned*/
+	inline unsigned lookup(const click_in6_addr &dst, unsigned mtu) const{
+		//nothing learned yet costs one branch
+		if (!__atomic_load_n(&_used, __ATOMIC_RELAXED)) {
+			return mtu;
+		}
+		uint64_t key[2];
+		make_key(dst, key);
+		const entry *ways = _sets[hash(key)].ways;
+		for (int w = 0; w < IP6PMTU_WAYS; w++) {
+			const entry &en = ways[w];
+			uint32_t seq = __atomic_load_n(&en.seq, __ATOMIC_ACQUIRE);
+			uint32_t m = __atomic_load_n(&en.mtu, __ATOMIC_RELAXED);
+			if ((seq & 1) || m == 0
+			    || __atomic_load_n(&en.key[0], __ATOMIC_RELAXED) != key[0]
+			    || __atomic_load_n(&en.key[1], __ATOMIC_RELAXED) != key[1]) {
+				continue;
+			}
+			uint32_t learned = __atomic_load_n(&en.learned, __ATOMIC_RELAXED);
+			__atomic_thread_fence(__ATOMIC_ACQUIRE);
+			if (__atomic_load_n(&en.seq, __ATOMIC_RELAXED) != seq) {
+				continue;
+			}
+			if ((uint32_t) click_jiffies() - learned >= _aging) {
+				return mtu;
+			}
+			return m < mtu ? m : mtu;
+		}
+		return mtu;
+	}
+
+	/*Records that the path to dst takes at most mtu bytes. Returns false if
+	 * mtu is below the IP6 minimum, which RFC 8201 says to ignore*/
+	bool learn(const click_in6_addr &dst, uint32_t mtu){
+		if (mtu < IP6PMTU_MIN) {
+			return false;
+		}
+		if (!_nsets) {
+			return true;
+		}
+		uint64_t key[2];
+		make_key(dst, key);
+		uint32_t now = click_jiffies();
+		_lock.acquire();
+		entry *ways = _sets[hash(key)].ways;
+		//the entry of the prefix, else an empty or aged one, else the oldest
+		entry *victim = ways;
+		uint32_t oldest = 0;
+		for (int w = 0; w < IP6PMTU_WAYS; w++) {
+			entry &en = ways[w];
+			uint32_t age = en.mtu && now - en.learned < _aging ? now - en.learned : ~0U;
+			if (en.mtu && en.key[0] == key[0] && en.key[1] == key[1]) {
+				//a Packet Too Big never raises the path MTU
+				if (age != ~0U && en.mtu <= mtu) {
+					_lock.release();
+					return true;
+				}
+				victim = &en;
+				break;
+			}
+			if (age >= oldest) {
+				oldest = age;
+				victim = &en;
+			}
+		}
+		write(*victim, key, mtu, now);
+		_lock.release();
+		__atomic_store_n(&_used, true, __ATOMIC_RELAXED);
+		return true;
+	}
+
+ private:
+
+	struct entry{
+		uint32_t seq;			//odd while being written
+		uint32_t mtu;			//0 if empty
+		uint32_t learned;		//jiffies
+		uint32_t padding;
+		uint64_t key[2];		//the prefix, in network order
+	};
+
+	struct set{
+		entry ways[IP6PMTU_WAYS];
+	};
+
+	set *_sets;
+	uint32_t _nsets;		//a power of 2
+	int _prefix;
+	uint64_t _mask[2];
+	uint32_t _aging;		//jiffies
+	bool _used;				//something was learned since the last flush
+	Spinlock _lock;
+
+	inline void make_key(const click_in6_addr &dst, uint64_t *key) const{
+		memcpy(key, &dst, 16);
+		key[0] &= _mask[0];
+		key[1] &= _mask[1];
+	}
+
+	inline uint32_t hash(const uint64_t *key) const{
+		uint64_t h = key[0] ^ (key[1] * 0x9E3779B97F4A7C15ULL);
+		//prefixes differ in their last bits, the high bits of h: fold them down
+		h = (h ^ (h >> 32)) * 0x9E3779B97F4A7C15ULL;
+		return (uint32_t) (h >> 32) & (_nsets - 1);
+	}
+
+	static void write(entry &en, const uint64_t *key, uint32_t mtu, uint32_t now){
+		uint32_t seq = en.seq;
+		__atomic_store_n(&en.seq, seq + 1, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_RELEASE);
+		__atomic_store_n(&en.key[0], key[0], __ATOMIC_RELAXED);
+		__atomic_store_n(&en.key[1], key[1], __ATOMIC_RELAXED);
+		__atomic_store_n(&en.mtu, mtu, __ATOMIC_RELAXED);
+		__atomic_store_n(&en.learned, now, __ATOMIC_RELAXED);
+		__atomic_store_n(&en.seq, seq + 2, __ATOMIC_RELEASE);
+	}
+
+	/*One line per live entry: prefix, MTU and age in seconds*/
+	static String dump_handler(Element *, void *thunk){
+		IP6PMTU *c = static_cast<IP6PMTU *>(thunk);
+		StringAccum sa;
+		uint32_t now = click_jiffies();
+		c->_lock.acquire();
+		for (uint32_t s = 0; s < c->_nsets; s++) {
+			for (int w = 0; w < IP6PMTU_WAYS; w++) {
+				const entry &en = c->_sets[s].ways[w];
+				if (!en.mtu || now - en.learned >= c->_aging) {
+					continue;
+				}
+				click_in6_addr prefix;
+				memcpy(&prefix, en.key, 16);
+				sa << IP6Address(prefix).unparse() << '/' << c->_prefix << ' '
+				   << en.mtu << ' ' << (now - en.learned) / CLICK_HZ << '\n';
+			}
+		}
+		c->_lock.release();
+		return sa.take_string();
+	}
+
+	static int flush_handler(const String &, Element *, void *thunk, ErrorHandler *){
+		IP6PMTU *c = static_cast<IP6PMTU *>(thunk);
+		c->_lock.acquire();
+		for (uint32_t s = 0; s < c->_nsets; s++) {
+			for (int w = 0; w < IP6PMTU_WAYS; w++) {
+				entry &en = c->_sets[s].ways[w];
+				if (en.mtu) {
+					uint64_t key[2] = { 0, 0 };
+					write(en, key, 0, 0);
+				}
+			}
+		}
+		__atomic_store_n(&c->_used, false, __ATOMIC_RELAXED);
+		c->_lock.release();
+		return 0;
+	}
+
+};
+
+CLICK_ENDDECLS
+#endif
@@ -0,0 +1,191 @@
+#ifndef CLICK_IP6PROFILE_HH
+#define CLICK_IP6PROFILE_HH
+#include <click/element.hh>
+#include <click/glue.hh>
+#include <click/cycles.hh>
+#include <click/straccum.hh>
+CLICK_DECLS
+
+/*
+ * Cycle profiles of the IP6 elements.
+ *
+ * Only compiled in when IP6_PROFILE is nonzero: build with CLICK_STATS of 2
+ * or more (--enable-stats=2), or with -DIP6_PROFILE=1. Otherwise no code
+ * or memory is spent on it.
+ *
+ * An element calls start() when push() begins. Every time it sends a packet
+ * on, the cycles since start() or since the last packet sent are recorded
+ * for that output, excluding the elements downstream. Dropped packets are
+ * recorded in a row of their own. Every sample also goes to the row of the
+ * whole element.
+ *
+ * Samples are counted in log-linear buckets, as in HdrHistogram: values up
+ * to 7 exactly, then 8 buckets per power of 2, so a bucket is at most 12.5%
+ * wide. Every thread counts in its own rows.
+ */
+
+#ifndef IP6_PROFILE
+# if defined(CLICK_STATS) && CLICK_STATS >= 2
+#  define IP6_PROFILE 1
+# else
+#  define IP6_PROFILE 0
+# endif
+#endif
+
+#if IP6_PROFILE
+
+class IP6Profile{ public:
+
+	enum{
+		SUB_BITS = 3,
+		SUB_BUCKETS = 1 << SUB_BITS,
+		MAX_BITS = 40,			//samples of 2^40 cycles or more share the last bucket
+		NBUCKETS = (MAX_BITS - SUB_BITS + 1) * SUB_BUCKETS
+	};
+
+	IP6Profile() : _memory(0), _blocks(0), _nblocks(0), _nports(0), _stride(0) {}
+	~IP6Profile()				{ delete[] _memory; }
+
+	/*Allocates the rows of nports outputs, the drops and the element*/
+	void configure(int nports){
+		delete[] _memory;
+		_nports = nports;
+		//start cycle count on a cache line, then the rows
+		_stride = 8 + (nports + 2) * NBUCKETS;
+		_nblocks = click_max_cpu_ids();
+		_memory = new uint64_t[_nblocks * _stride + 7];
+		_blocks = reinterpret_cast<uint64_t *>((reinterpret_cast<uintptr_t>(_memory) + 63) & ~(uintptr_t) 63);
+		clear();
+	}
+
+	void add_handlers(Element *e){
+		e->add_read_handler("profile", read_profile, this);
+		e->add_read_handler("profile_buckets", read_buckets, this);
+	}
+
+	inline void start(){
+		block()[0] = click_get_cycles();
+	}
+
+	/*Records the cycles since the last start() or sample() for output port,
+	 * or for the drops if port is the number of outputs*/
+	inline void sample(int port){
+		uint64_t *b = block();
+		uint64_t now = click_get_cycles();
+		int i = bucket(now - b[0]);
+		b[8 + port * NBUCKETS + i]++;
+		b[8 + (_nports + 1) * NBUCKETS + i]++;
+		b[0] = now;
+	}
+
+	void clear(){
+		for (unsigned i = 0; i < _nblocks * _stride; i++) {
+			__atomic_store_n(&_blocks[i], 0, __ATOMIC_RELAXED);
+		}
+	}
+
+	static inline int bucket(uint64_t cycles){
+		if (cycles < SUB_BUCKETS) {
+			return cycles;
+		}
+		int e = 63 - __builtin_clzll(cycles);
+		if (e >= MAX_BITS) {
+			return NBUCKETS - 1;
+		}
+		return (e - SUB_BITS + 1) * SUB_BUCKETS + ((cycles >> (e - SUB_BITS)) & (SUB_BUCKETS - 1));
+	}
+
+	/*Smallest value counted in bucket i*/
+	static inline uint64_t bucket_low(int i){
+		if (i < SUB_BUCKETS) {
+			return i;
+		}
+		int e = i / SUB_BUCKETS + SUB_BITS - 1;
+		return (uint64_t) (SUB_BUCKETS + i % SUB_BUCKETS) << (e - SUB_BITS);
+	}
+
+ private:
+
+	uint64_t *_memory;
+	uint64_t *_blocks;		//_memory aligned on a cache line
+	unsigned _nblocks;
+	int _nports;
+	int _stride;			//counters per thread
+
+	inline uint64_t *block(){
+		return _blocks + click_current_cpu_id() * _stride;
+	}
+
+	/*Adds up row of every thread into counts; returns the number of samples*/
+	uint64_t sum_row(int row, uint64_t *counts) const{
+		uint64_t n = 0;
+		for (int i = 0; i < NBUCKETS; i++) {
+			counts[i] = 0;
+			for (unsigned t = 0; t < _nblocks; t++) {
+				counts[i] += __atomic_load_n(&_blocks[t * _stride + 8 + row * NBUCKETS + i], __ATOMIC_RELAXED);
+			}
+			n += counts[i];
+		}
+		return n;
+	}
+
+	/*Highest value of the bucket holding the sample of rank per_mille/1000*/
+	static uint64_t percentile(const uint64_t *counts, uint64_t n, int per_mille){
+		uint64_t rank = (n * per_mille + 999) / 1000, seen = 0;
+		for (int i = 0; i < NBUCKETS - 1; i++) {
+			seen += counts[i];
+			if (seen >= rank) {
+				return bucket_low(i + 1) - 1;
+			}
+		}
+		return bucket_low(NBUCKETS - 1);
+	}
+
+	static String row_name(const IP6Profile *p, int row){
+		if (row < p->_nports) {
+			return String(row);
+		}
+		return row == p->_nports ? String("drops") : String("all");
+	}
+
+	/*One line per row with samples: output, samples, p50, p99 and p99.9 in cycles*/
+	static String read_profile(Element *, void *thunk){
+		const IP6Profile *p = static_cast<const IP6Profile *>(thunk);
+		uint64_t counts[NBUCKETS];
+		StringAccum sa;
+		for (int row = 0; row < p->_nports + 2; row++) {
+			uint64_t n = p->sum_row(row, counts);
+			if (n == 0) {
+				continue;
+			}
+			sa << row_name(p, row) << ' ' << n << ' ' << percentile(counts, n, 500)
+			   << ' ' << percentile(counts, n, 990) << ' ' << percentile(counts, n, 999) << '\n';
+		}
+		return sa.take_string();
+	}
+
+	/*One line per bucket with samples: output, lowest value of the bucket, samples*/
+	static String read_buckets(Element *, void *thunk){
+		const IP6Profile *p = static_cast<const IP6Profile *>(thunk);
+		uint64_t counts[NBUCKETS];
+		StringAccum sa;
+		for (int row = 0; row < p->_nports + 2; row++) {
+			if (p->sum_row(row, counts) == 0) {
+				continue;
+			}
+			String name = row_name(p, row);
+			for (int i = 0; i < NBUCKETS; i++) {
+				if (counts[i]) {
+					sa << name << ' ' << bucket_low(i) << ' ' << counts[i] << '\n';
+				}
+			}
+		}
+		return sa.take_string();
+	}
+
+};
+
+#endif
+
+CLICK_ENDDECLS
+#endif
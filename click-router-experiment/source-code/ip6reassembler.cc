@@ -0,0 +1,485 @@
+/*
+ * ip6reassembler.{cc,hh} -- element reassembles IP6 fragments
+ */
+
+#include <click/config.h>
+#include "ip6reassembler.hh"
+#include "ip6extparse.hh"
+#include <clicknet/ip6.h>
+#include <click/args.hh>
+#include <click/error.hh>
+#include <click/glue.hh>
+CLICK_DECLS
+
+IP6Reassembler::IP6Reassembler()
+  : _max_memory(4194304), _timeout(60), _min_fragment(256), _timer(this),
+    _tick(0), _memory(0), _ndatagrams(0), _reassembled(0), _reassembled_tick(0),
+    _rate(0), _timeouts(0), _evictions(0)
+{
+	_hash_key[0] = _hash_key[1] = 0;
+}
+
+IP6Reassembler::~IP6Reassembler()
+{
+}
+
+int
+IP6Reassembler::configure(Vector<String> &conf, ErrorHandler *errh)
+{
+    if (_trace.configure(conf, this, errh) < 0)
+	return -1;
+    _stats.configure(noutputs());
+    if (Args(conf, this, errh)
+	.read("MEMORY", _max_memory)
+	.read("TIMEOUT", _timeout)
+	.read("MIN_FRAGMENT", _min_fragment)
+	.complete() < 0)
+	return -1;
+    if (_timeout < 1 || _timeout > 255)
+	return errh->error("TIMEOUT must be 1 to 255 seconds");
+    if (_max_memory < sizeof(datagram))
+	return errh->error("MEMORY must be at least %d", (int) sizeof(datagram));
+
+    //about one datagram per bucket when MEMORY is full of small ones
+    int nbuckets = BUCKETS_MIN;
+    while (nbuckets < (int) (_max_memory / 2048) && nbuckets < (1 << 20)) {
+	nbuckets *= 2;
+    }
+    _buckets.assign(nbuckets, 0);
+    //a datagram expiring at tick t lies in slot t % (TIMEOUT + 1)
+    _slots.resize(_timeout + 1);
+    for (int i = 0; i < _slots.size(); i++) {
+	_slots[i].prev = _slots[i].next = &_slots[i];
+    }
+    return 0;
+}
+
+int
+IP6Reassembler::initialize(ErrorHandler *)
+{
+	_timer.initialize(this);
+	_timer.schedule_after_sec(1);
+	//click_random() gives 31 bits at a time
+	for (int i = 0; i < 2; i++) {
+		_hash_key[i] = ((uint64_t) click_random() << 33) ^ ((uint64_t) click_random() << 16) ^ click_random();
+	}
+	return 0;
+}
+
+void
+IP6Reassembler::cleanup(CleanupStage)
+{
+	for (int i = 0; i < _buckets.size(); i++) {
+		while (datagram *d = _buckets[i]) {
+			release(d, -1);
+		}
+	}
+}
+
+static inline uint64_t
+rotl64(uint64_t x, int b){
+	return (x << b) | (x >> (64 - b));
+}
+
+static inline void
+sipround(uint64_t &v0, uint64_t &v1, uint64_t &v2, uint64_t &v3){
+	v0 += v1; v1 = rotl64(v1, 13); v1 ^= v0; v0 = rotl64(v0, 32);
+	v2 += v3; v3 = rotl64(v3, 16); v3 ^= v2;
+	v0 += v3; v3 = rotl64(v3, 21); v3 ^= v0;
+	v2 += v1; v1 = rotl64(v1, 17); v1 ^= v2; v2 = rotl64(v2, 32);
+}
+
+/*
+ * Bucket of a datagram: SipHash-2-4 of its addresses and Identification
+ * under a key drawn at initialization, so that a sender cannot choose
+ * fragments that all fall in one bucket.
+ */
+inline uint32_t
+IP6Reassembler::hash(const click_in6_addr &src, const click_in6_addr &dst, uint32_t id) const{
+	uint64_t v0 = _hash_key[0] ^ 0x736f6d6570736575ULL;
+	uint64_t v1 = _hash_key[1] ^ 0x646f72616e646f6dULL;
+	uint64_t v2 = _hash_key[0] ^ 0x6c7967656e657261ULL;
+	uint64_t v3 = _hash_key[1] ^ 0x7465646279746573ULL;
+	uint64_t m[5];
+	memcpy(m, &src, 16);
+	memcpy(m + 2, &dst, 16);
+	m[4] = ((uint64_t) 36 << 56) | id;	//the message length, 36 bytes, ends the last word
+	for (int i = 0; i < 5; i++) {
+		v3 ^= m[i];
+		sipround(v0, v1, v2, v3);
+		sipround(v0, v1, v2, v3);
+		v0 ^= m[i];
+	}
+	v2 ^= 0xFF;
+	for (int i = 0; i < 4; i++) {
+		sipround(v0, v1, v2, v3);
+	}
+	return v0 ^ v1 ^ v2 ^ v3;
+}
+
+IP6Reassembler::datagram *
+IP6Reassembler::find(const click_in6_addr &src, const click_in6_addr &dst, uint32_t id, uint32_t h){
+	for (datagram *d = _buckets[h & (_buckets.size() - 1)]; d; d = d->hnext) {
+		if (d->id == id && memcmp(&d->src, &src, sizeof(src)) == 0
+		    && memcmp(&d->dst, &dst, sizeof(dst)) == 0) {
+			return d;
+		}
+	}
+	return 0;
+}
+
+/*Adds an empty datagram expiring TIMEOUT seconds from now*/
+IP6Reassembler::datagram *
+IP6Reassembler::create(const click_in6_addr &src, const click_in6_addr &dst, uint32_t id, uint32_t h){
+	while (_memory + sizeof(datagram) > _max_memory && evict_oldest(0)) {
+	}
+	if (_memory + sizeof(datagram) > _max_memory) {
+		return 0;
+	}
+	datagram *d = new datagram;
+	if (!d) {
+		return 0;
+	}
+	d->src = src;
+	d->dst = dst;
+	d->id = id;
+	d->expires = _tick + _timeout;
+	d->total = 0;
+	d->received = 0;
+	d->memory = sizeof(datagram);
+	d->abandoned = false;
+	d->nfrags = 0;
+	d->nxt_pos = 0;
+	d->nxt = 0;
+
+	datagram *&bucket = _buckets[h & (_buckets.size() - 1)];
+	d->hnext = bucket;
+	bucket = d;
+	//newest last in its slot
+	link *slot = &_slots[d->expires % _slots.size()];
+	d->wheel.prev = slot->prev;
+	d->wheel.next = slot;
+	slot->prev->next = &d->wheel;
+	slot->prev = &d->wheel;
+
+	_memory += d->memory;
+	_ndatagrams++;
+	return d;
+}
+
+/*Frees d and its fragments, counted as drops for reason if it is not -1*/
+void
+IP6Reassembler::release(datagram *d, int reason){
+	datagram **pprev = &_buckets[hash(d->src, d->dst, d->id) & (_buckets.size() - 1)];
+	while (*pprev != d) {
+		pprev = &(*pprev)->hnext;
+	}
+	*pprev = d->hnext;
+	d->wheel.prev->next = d->wheel.next;
+	d->wheel.next->prev = d->wheel.prev;
+
+	for (int i = 0; i < d->nfrags; i++) {
+		d->frags[i].p->kill();
+		if (reason >= 0) {
+			_stats.drop(reason);
+		}
+	}
+	_memory -= d->memory;
+	_ndatagrams--;
+	delete d;
+}
+
+/*Drops the fragments of d for reason; d stays until it expires so that its
+ * later fragments are dropped too*/
+void
+IP6Reassembler::abandon(datagram *d, int reason){
+	for (int i = 0; i < d->nfrags; i++) {
+		d->frags[i].p->kill();
+		_stats.drop(reason);
+	}
+	d->nfrags = 0;
+	d->received = 0;
+	_memory -= d->memory - sizeof(datagram);
+	d->memory = sizeof(datagram);
+	d->abandoned = true;
+}
+
+/*Frees the datagram expiring first, except keep; returns false if there is
+ * none*/
+bool
+IP6Reassembler::evict_oldest(const datagram *keep){
+	for (int k = 1; k <= _slots.size(); k++) {
+		link *slot = &_slots[(_tick + k) % _slots.size()];
+		for (link *l = slot->next; l != slot; l = l->next) {
+			datagram *d = reinterpret_cast<datagram *>(l);
+			if (d != keep) {
+				release(d, IP6DROP_FRAG_EVICTED);
+				_evictions++;
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+/*Makes the datagram of the fragments of d, which cover all of it*/
+WritablePacket *
+IP6Reassembler::assemble(datagram *d){
+	Packet *first = d->frags[0].p;
+	int unfragmentable_len = d->frags[0].data - FRAG_HDR_LEN;
+	WritablePacket *q = Packet::make(Packet::default_headroom, 0, unfragmentable_len + d->total, 0);
+	if (!q) {
+		return 0;
+	}
+	unsigned char *data = q->data();
+	memcpy(data, first->data(), unfragmentable_len);
+	data[d->nxt_pos] = d->nxt;
+	for (int i = 0; i < d->nfrags; i++) {
+		const fragment &f = d->frags[i];
+		memcpy(data + unfragmentable_len + f.offset, f.p->data() + f.data, f.length);
+	}
+	reinterpret_cast<click_ip6 *>(data)->ip6_plen = htons(unfragmentable_len + d->total - sizeof(click_ip6));
+	q->copy_annotations(first);
+	ip6_ext_clear(q);
+	q->set_network_header(data, sizeof(click_ip6));
+	return q;
+}
+
+/*Removes the Fragment header of an atomic fragment*/
+void
+IP6Reassembler::strip_fragment_header(Packet *p_in, const ip6_ext_info &info){
+	int frag = info.frag;
+	uint8_t nxt = p_in->data()[frag];
+	WritablePacket *p = p_in->uniqueify();
+	if (!p) {
+		//uniqueify() freed the packet
+		_stats.drop(IP6DROP_NO_MEMORY);
+		return;
+	}
+	unsigned char *data = p->data();
+	//the headers in front move over the Fragment header
+	memmove(data + FRAG_HDR_LEN, data, frag);
+	data[FRAG_HDR_LEN + info.unfrag_nxt] = nxt;
+	p->pull(FRAG_HDR_LEN);
+	click_ip6 *ip = reinterpret_cast<click_ip6 *>(p->data());
+	ip->ip6_plen = htons(ntohs(ip->ip6_plen) - FRAG_HDR_LEN);
+	ip6_ext_clear(p);
+	p->set_network_header(p->data(), sizeof(click_ip6));
+	_stats.emit(this, 0, p, IP6DROP_NO_OUTPUT);
+}
+
+/*Sends a malformed or tiny fragment to output 1, or drops it*/
+void
+IP6Reassembler::reject(Packet *p, int reason, int event, uint32_t arg){
+	if (unlikely(_trace.enabled()))
+		_trace.record(event, arg);
+	_stats.emit(this, 1, p, reason);
+}
+
+/*Smallest upper layer header the first fragment must hold*/
+static inline int
+upper_layer_min(int proto){
+	switch (proto) {
+	case 6:		return 20;		//TCP
+	case 17:	return 8;		//UDP
+	case 58:	return 4;		//ICMP6
+	case 50:	return 8;		//ESP
+	default:	return 0;
+	}
+}
+
+void
+IP6Reassembler::push(int, Packet *p) {
+	_stats.profile_start();
+
+	ip6_ext_info info;
+	ip6_ext_get(p, 0, info);
+	if (!info.frag) {
+		_stats.emit(this, 0, p, IP6DROP_NO_OUTPUT);
+		return;
+	}
+	const click_ip6 *ip = reinterpret_cast<const click_ip6 *>(p->data());
+	const click_ip6_header_ext *frag = reinterpret_cast<const click_ip6_header_ext *>(p->data() + info.frag);
+	uint16_t offset_flag = ntohs(frag->ip6_frag._frag_offset_flag);
+	int offset = offset_flag & 0xFFF8;
+	bool more = offset_flag & 1;
+	int data = info.frag + FRAG_HDR_LEN;
+	int end = ntohs(ip->ip6_plen) + sizeof(click_ip6);
+
+	//a jumbogram cannot be fragmented, and the Fragment header must close
+	//the unfragmentable part
+	if (ip->ip6_plen == 0 || end > (int) p->length() || end < data || info.frag != info.unfrag_len) {
+		reject(p, IP6DROP_FRAG_BAD, IP6TRACE_FRAG_BAD, offset);
+		return;
+	}
+	int dlen = end - data;
+	if (offset == 0 && !more) {
+		strip_fragment_header(p, info);
+		return;
+	}
+	if ((more && (dlen & 7 || dlen == 0)) || info.unfrag_len - sizeof(click_ip6) + offset + dlen > 0xFFFF) {
+		reject(p, IP6DROP_FRAG_BAD, IP6TRACE_FRAG_BAD, offset);
+		return;
+	}
+	if (offset == 0 && ((info.flags & ip6_ext_info::F_TRUNCATED) || !info.l4
+			    || info.l4 + upper_layer_min(info.proto) > end)) {
+		//the header chain runs into the next fragment
+		reject(p, IP6DROP_FRAG_TINY, IP6TRACE_FRAG_TINY, dlen);
+		return;
+	}
+	if (more && (uint32_t) dlen < _min_fragment) {
+		reject(p, IP6DROP_FRAG_TINY, IP6TRACE_FRAG_TINY, dlen);
+		return;
+	}
+
+	fragment f;
+	f.offset = offset;
+	f.length = dlen;
+	f.data = data;
+	f.p = p;
+	uint32_t fend = offset + dlen;
+	uint32_t h = hash(ip->ip6_src, ip->ip6_dst, frag->ip6_frag._frag_id);
+	int reason = -1;
+	WritablePacket *q = 0;
+
+	_lock.acquire();
+	datagram *d = find(ip->ip6_src, ip->ip6_dst, frag->ip6_frag._frag_id, h);
+	if (!d) {
+		d = create(ip->ip6_src, ip->ip6_dst, frag->ip6_frag._frag_id, h);
+	}
+	int i = d ? d->nfrags : 0;
+	if (d) {
+		//fragments mostly come in order: look from the last one back
+		while (i > 0 && d->frags[i - 1].offset >= offset) {
+			i--;
+		}
+	}
+	if (!d) {
+		reason = IP6DROP_NO_MEMORY;
+	} else if (d->abandoned) {
+		reason = IP6DROP_FRAG_OVERLAP;
+	} else if (i < d->nfrags && d->frags[i].offset == offset && d->frags[i].length == dlen) {
+		reason = IP6DROP_FRAG_DUPLICATE;
+	} else if ((!more && d->total && d->total != fend)
+		   || (!more && d->nfrags && d->frags[d->nfrags - 1].offset + d->frags[d->nfrags - 1].length > fend)
+		   || (more && d->total && fend > d->total)) {
+		//past the end of the datagram
+		abandon(d, IP6DROP_FRAG_OVERLAP);
+		reason = IP6DROP_FRAG_BAD;
+	} else if ((i > 0 && d->frags[i - 1].offset + d->frags[i - 1].length > (uint32_t) offset)
+		   || (i < d->nfrags && fend > d->frags[i].offset)) {
+		abandon(d, IP6DROP_FRAG_OVERLAP);
+		reason = IP6DROP_FRAG_OVERLAP;
+		if (unlikely(_trace.enabled()))
+			_trace.record(IP6TRACE_FRAG_OVERLAP, offset);
+	} else if (d->nfrags == FRAGS_MAX) {
+		reason = IP6DROP_FRAG_TINY;
+	} else {
+		uint32_t need = p->buffer_length();
+		while (_memory + need > _max_memory && evict_oldest(d)) {
+		}
+		if (_memory + need > _max_memory) {
+			reason = IP6DROP_NO_MEMORY;
+		} else {
+			memmove(&d->frags[i + 1], &d->frags[i], (d->nfrags - i) * sizeof(fragment));
+			d->frags[i] = f;
+			d->nfrags++;
+			d->received += dlen;
+			d->memory += need;
+			_memory += need;
+			if (offset == 0) {
+				d->nxt_pos = info.unfrag_nxt;
+				d->nxt = frag->ip6_frag._frag_nxt_header;
+			}
+			if (!more) {
+				d->total = fend;
+			}
+			//fragments never overlap, so all bytes are there once they add up.
+			//The datagram takes the unfragmentable part of the first one,
+			//which may be longer than that of the others and push it past
+			//65535 bytes (RFC 8200 4.5)
+			if (d->total && d->received == d->total
+			    && d->frags[0].data - FRAG_HDR_LEN - sizeof(click_ip6) + d->total > 0xFFFF) {
+				if (unlikely(_trace.enabled()))
+					_trace.record(IP6TRACE_FRAG_BAD, offset);
+				abandon(d, IP6DROP_FRAG_BAD);
+			} else if (d->total && d->received == d->total) {
+				q = assemble(d);
+				if (q) {
+					_reassembled++;
+					release(d, -1);
+				} else {
+					release(d, IP6DROP_NO_MEMORY);
+				}
+			}
+		}
+	}
+	_lock.release();
+
+	if (reason == IP6DROP_FRAG_BAD) {
+		reject(p, reason, IP6TRACE_FRAG_BAD, offset);
+	} else if (reason >= 0) {
+		_stats.drop(p, reason);
+	} else if (q) {
+		_stats.emit(this, 0, q, IP6DROP_NO_OUTPUT);
+	}
+}
+
+/*Turns the wheel by one second, dropping the datagrams expiring*/
+void
+IP6Reassembler::run_timer(Timer *){
+	_lock.acquire();
+	_tick++;
+	link *slot = &_slots[_tick % _slots.size()];
+	while (slot->next != slot) {
+		datagram *d = reinterpret_cast<datagram *>(slot->next);
+		if (!d->abandoned) {
+			_timeouts++;
+		}
+		release(d, IP6DROP_FRAG_TIMEOUT);
+	}
+	_rate = _reassembled - _reassembled_tick;
+	_reassembled_tick = _reassembled;
+	_lock.release();
+	_timer.reschedule_after_sec(1);
+}
+
+enum { H_MEMORY, H_DATAGRAMS, H_REASSEMBLED, H_RATE, H_TIMEOUTS, H_EVICTIONS };
+
+String
+IP6Reassembler::read_handler(Element *e, void *thunk)
+{
+	IP6Reassembler *r = static_cast<IP6Reassembler *>(e);
+	switch ((intptr_t) thunk) {
+	case H_MEMORY:
+		return String(r->_memory);
+	case H_DATAGRAMS:
+		return String(r->_ndatagrams);
+	case H_REASSEMBLED:
+		return String(r->_reassembled);
+	case H_RATE:
+		return String(r->_rate);
+	case H_TIMEOUTS:
+		return String(r->_timeouts);
+	case H_EVICTIONS:
+		return String(r->_evictions);
+	default:
+		return String();
+	}
+}
+
+void
+IP6Reassembler::add_handlers()
+{
+	add_read_handler("memory", read_handler, H_MEMORY);
+	add_read_handler("datagrams", read_handler, H_DATAGRAMS);
+	add_read_handler("reassembled", read_handler, H_REASSEMBLED);
+	add_read_handler("rate", read_handler, H_RATE);
+	add_read_handler("timeouts", read_handler, H_TIMEOUTS);
+	add_read_handler("evictions", read_handler, H_EVICTIONS);
+	_trace.add_handlers(this);
+	_stats.add_handlers(this);
+}
+
+CLICK_ENDDECLS
+EXPORT_ELEMENT(IP6Reassembler)
@@ -0,0 +1,246 @@
+#ifndef CLICK_IP6REASSEMBLER_HH
+#define CLICK_IP6REASSEMBLER_HH
+#include <click/element.hh>
+#include <click/glue.hh>
+#include <click/timer.hh>
+#include <click/sync.hh>
+#include <click/vector.hh>
+#include "ip6trace.hh"
+#include "ip6stats.hh"
+#include "ip6extparse.hh"
+CLICK_DECLS
+
+/*
+ * =c
+ * IP6Reassembler([I<keywords> MEMORY, TIMEOUT, MIN_FRAGMENT])
+ * =s ip6
+ *
+ * =d
+ * Expects IP6 packets as input. Packets without a Fragment header are
+ * emitted on output 0 as they are. Fragments are held until every fragment
+ * of their datagram, named by source, destination and Identification, has
+ * arrived; the reassembled datagram is then emitted on output 0. It carries
+ * the unfragmentable part and the annotations of the first fragment.
+ * A fragment with offset 0 and no more fragments is emitted at once, with
+ * its Fragment header removed (RFC 6946).
+ *
+ * Datagrams not reassembled within TIMEOUT seconds are abandoned. Expiry is
+ * kept on a timing wheel of one-second slots, turned by a single timer, so
+ * each datagram costs no timer of its own. When holding a fragment would
+ * take more than MEMORY bytes, the oldest datagrams are abandoned first.
+ *
+ * Against fragment attacks, as RFC 8200, RFC 5722 and RFC 7112 ask:
+ *
+ * =over 8
+ *
+ * =item *
+ *
+ * A fragment overlapping another abandons its datagram, and the later
+ * fragments of that datagram are dropped until it times out. An exact
+ * duplicate of a fragment held is dropped alone.
+ *
+ * =item *
+ *
+ * A first fragment must hold the whole header chain up to the upper layer
+ * header. Other fragments but the last must hold at least MIN_FRAGMENT
+ * bytes of data, and a datagram at most 64 fragments.
+ *
+ * =item *
+ *
+ * Fragments whose data is not a multiple of 8 bytes while more fragments
+ * follow, run past 65535 bytes or past the last fragment are malformed. A
+ * datagram that the unfragmentable part of its first fragment would bring
+ * past 65535 bytes is abandoned.
+ *
+ * =item *
+ *
+ * Datagrams are looked up in a hash table keyed with a secret drawn when
+ * the router starts, so that a sender cannot crowd its fragments into one
+ * bucket.
+ *
+ * =back
+ *
+ * Malformed and tiny fragments are sent to output 1, if present, for
+ * ICMP6Error to answer with a Parameter Problem; they are dropped
+ * otherwise.
+ *
+ * Keyword arguments are:
+ *
+ * =over 8
+ *
+ * =item MEMORY
+ *
+ * Unsigned integer. Most bytes held in fragments and datagram state.
+ * Default is 4194304.
+ *
+ * =item TIMEOUT
+ *
+ * Unsigned integer. Seconds a datagram may take to arrive, 1 to 255.
+ * Default is 60.
+ *
+ * =item MIN_FRAGMENT
+ *
+ * Unsigned integer. Fewest bytes of data in a fragment other than the last.
+ * Default is 256.
+ *
+ * =item TRACE
+ *
+ * Boolean. Record malformed, tiny and overlapping fragments in the trace
+ * ring. Default is false.
+ *
+ * =item TRACE_RATE
+ *
+ * Unsigned integer. Most events recorded per second and thread. Default is
+ * 100.
+ *
+ * =back
+ *
+ * =h memory read-only
+ *
+ * Bytes held.
+ *
+ * =h datagrams read-only
+ *
+ * Datagrams being reassembled.
+ *
+ * =h reassembled read-only
+ *
+ * Datagrams reassembled.
+ *
+ * =h rate read-only
+ *
+ * Datagrams reassembled during the last second.
+ *
+ * =h timeouts read-only
+ *
+ * Datagrams abandoned after TIMEOUT.
+ *
+ * =h evictions read-only
+ *
+ * Datagrams abandoned to stay within MEMORY.
+ *
+ * =h port_counts read-only
+ *
+ * Packets and bytes sent on each output, one line per output.
+ *
+ * =h drop_counts read-only
+ *
+ * Packets dropped for each reason, one line per reason. Fragments of the
+ * datagrams abandoned are counted here.
+ *
+ * =h drops read-only
+ *
+ * Packets dropped.
+ *
+ * =h reset write-only
+ *
+ * Zeroes the counters of port_counts and drop_counts.
+ *
+ * =h trace read/write
+ *
+ * Whether events are recorded.
+ *
+ * =h trace_dump read-only
+ *
+ * Events recorded, oldest first.
+ *
+ * =e
+ *
+ *   ... -> re :: IP6Reassembler(MEMORY 16777216) -> ...
+ *   re[1] -> ICMP6Error(2001:db8::1, 4, 0) -> ...
+ *
+ * =a IP6Fragmenter, ICMP6Error */
+
+class IP6Reassembler : public Element {
+
+  enum{
+	  FRAG_HDR_LEN = 8,
+	  FRAGS_MAX = 64,		//fragments per datagram
+	  BUCKETS_MIN = 64
+  };
+
+  struct link{
+	  link *prev;
+	  link *next;
+  };
+
+  struct fragment{
+	  uint16_t offset;		//in the fragmentable part
+	  uint16_t length;
+	  uint16_t data;		//offset of the data in p
+	  Packet *p;
+  };
+
+  /*One datagram being reassembled. The wheel link comes first, so a link
+   * of a slot list is the datagram itself*/
+  struct datagram{
+	  link wheel;			//in the slot of its expiry, oldest first
+	  datagram *hnext;		//in its hash bucket
+	  click_in6_addr src;
+	  click_in6_addr dst;
+	  uint32_t id;
+	  uint32_t expires;		//tick
+	  uint32_t total;		//length of the fragmentable part, 0 until the last fragment
+	  uint32_t received;	//data bytes held
+	  uint32_t memory;
+	  bool abandoned;		//overlapping fragments: drop the others
+	  uint8_t nxt;			//Next Header of the first fragment's Fragment header
+	  uint16_t nxt_pos;		//offset of the Next Header field pointing to it
+	  int nfrags;
+	  fragment frags[FRAGS_MAX];	//sorted by offset
+  };
+
+  IP6Trace _trace;
+  IP6Stats _stats;
+
+  uint32_t _max_memory;
+  uint32_t _timeout;
+  uint32_t _min_fragment;
+
+  Spinlock _lock;
+  Timer _timer;
+  Vector<datagram *> _buckets;
+  Vector<link> _slots;		//timing wheel
+  uint32_t _tick;			//seconds since initialize()
+  uint32_t _memory;
+  uint32_t _ndatagrams;
+  uint64_t _reassembled;
+  uint64_t _reassembled_tick;	//_reassembled at the last tick
+  uint64_t _rate;
+  uint64_t _timeouts;
+  uint64_t _evictions;
+  uint64_t _hash_key[2];	//SipHash key, drawn in initialize()
+
+  inline uint32_t hash(const click_in6_addr &src, const click_in6_addr &dst, uint32_t id) const;
+  datagram *find(const click_in6_addr &src, const click_in6_addr &dst, uint32_t id, uint32_t h);
+  datagram *create(const click_in6_addr &src, const click_in6_addr &dst, uint32_t id, uint32_t h);
+  void release(datagram *d, int reason);
+  void abandon(datagram *d, int reason);
+  bool evict_oldest(const datagram *keep);
+  WritablePacket *assemble(datagram *d);
+  void strip_fragment_header(Packet *p, const ip6_ext_info &info);
+  void reject(Packet *p, int reason, int event, uint32_t arg);
+
+  static String read_handler(Element *e, void *thunk);
+
+ public:
+
+  IP6Reassembler();
+  ~IP6Reassembler();
+
+  const char *class_name() const		{ return "IP6Reassembler"; }
+  const char *port_count() const		{ return PORTS_1_1X2; }
+  const char *processing() const		{ return PUSH; }
+  int configure(Vector<String> &, ErrorHandler *);
+  int initialize(ErrorHandler *);
+  void cleanup(CleanupStage);
+
+  void add_handlers();
+  void run_timer(Timer *);
+
+  void push(int, Packet *p);
+
+};
+
+CLICK_ENDDECLS
+#endif
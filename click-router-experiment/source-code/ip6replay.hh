@@ -0,0 +1,98 @@
+#ifndef CLICK_IP6REPLAY_HH
+#define CLICK_IP6REPLAY_HH
+#include <click/element.hh>
+#include <click/glue.hh>
+#include <click/vector.hh>
+CLICK_DECLS
+
+/*
+ * =c
+ * IP6Replay(FILE [, I<keywords> PASSES])
+ * =s ip6
+ *
+ * =d
+ *
+ * Userlevel replay of a pcap trace at the highest rate. The IP6 packets of
+ * FILE are loaded in memory when the configuration is installed. Writing
+ * the C<run> handler pushes them downstream, in order, PASSES times over,
+ * timing the loop. A packet is pushed as a clone of the loaded one, so no
+ * data is copied unless an element downstream writes to it. It also times a
+ * loop that only makes and frees the clones, and reports the difference as
+ * the cost of the elements downstream.
+ *
+ * FILE may hold raw IP (LINKTYPE_RAW or LINKTYPE_IPV6), Ethernet, with at
+ * most one VLAN tag, or Linux cooked captures, with microsecond or
+ * nanosecond timestamps, in either byte order. Frames that do not hold IP6,
+ * or were truncated by the capture, are skipped.
+ *
+ * How the packets leave each element is read from the C<port_counts> and
+ * C<drop_counts> handlers of the elements, and the time each element takes
+ * from their C<profile> handler, if built with IP6_PROFILE. See
+ * ip6replay.click.
+ *
+ * Keyword arguments are:
+ *
+ * =over 8
+ *
+ * =item PASSES
+ *
+ * Unsigned integer. Times the trace is pushed per run. Default is 100.
+ *
+ * =back
+ *
+ * =h run write-only
+ *
+ * Runs the replay, with the number of passes written if it is not empty.
+ *
+ * =h result read-only
+ *
+ * Result of the last run, as one line of JSON: the trace, packets and bytes
+ * per pass, passes, then ns_per_packet, mpps, gbps and cycles_per_packet for
+ * the elements downstream, and baseline_ns_per_packet for making and freeing
+ * a clone.
+ *
+ * =h packets read-only
+ *
+ * Packets loaded.
+ *
+ * =h skipped read-only
+ *
+ * Frames of FILE skipped.
+ *
+ * =e
+ *
+ *   r :: IP6Replay(traces/ext-mix.pcap) -> IP6HopByHop -> Discard;
+ *   Script(write r.run, print $(r.result), stop);
+ *
+ * =a IP6ExtBench, FromDump */
+
+class IP6Replay : public Element {
+
+  String _filename;
+  uint32_t _passes;
+  Vector<Packet *> _packets;
+  uint64_t _bytes;
+  uint32_t _skipped;
+  String _result;
+
+  int load(const String &data, ErrorHandler *errh);
+  static int write_run(const String &s, Element *e, void *thunk, ErrorHandler *errh);
+  static String read_handler(Element *e, void *thunk);
+
+ public:
+
+  IP6Replay();
+  ~IP6Replay();
+
+  const char *class_name() const		{ return "IP6Replay"; }
+  const char *port_count() const		{ return PORTS_0_1; }
+  const char *processing() const		{ return PUSH; }
+  int configure(Vector<String> &, ErrorHandler *);
+  void cleanup(CleanupStage);
+
+  void add_handlers();
+
+};
+
+CLICK_ENDDECLS
+#endif
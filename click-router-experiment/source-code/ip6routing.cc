@@ -17,6 +17,7 @@
 
 #include <click/config.h>
 #include "ip6routing.hh"
+#include "ip6extparse.hh"
 #include <clicknet/ip6.h>
 #include <click/args.hh>
 #include <click/error.hh>
@@ -24,7 +25,6 @@
 CLICK_DECLS
 
 IP6Routing::IP6Routing()
-  : _drops(0)
 {
 
 }
@@ -36,7 +36,10 @@ IP6Routing::~IP6Routing()
 
 int
 IP6Routing::configure(Vector<String> &conf, ErrorHandler *errh) {
-    return 0;
+    if (_trace.configure(conf, this, errh) < 0)
+	return -1;
+    _stats.configure(noutputs());
+    return Args(conf, this, errh).complete();
 }
 
 void
@@ -48,138 +51,130 @@ IP6Routing::routing(Packet *p_in){
 	const click_ip6 *ip_in = reinterpret_cast <const click_ip6 *>( p_in->data() + _offset);
 	const click_ip6_header_ext *header;
 	click_ip6_header_ext *out_header;
-	int pace = sizeof(click_ip6);
+	ip6_ext_info info;
+	int pace;
 	uint8_t header_length;	//header extension length
 	int number_of_addresses = 0;
 	WritablePacket *p;
 	click_in6_addr cur_dst_addr;
-	int cur_hdr_ext = ip_in->ip6_nxt;
 
 	//hop limit
 	hll = ip_in->ip6_hlim;
 	if(hll == 0){
 		//drop the packet
+		if (unlikely(_trace.enabled()))
+			_trace.record(IP6TRACE_HLIM_ZERO, ntohs(ip_in->ip6_plen));
+		_stats.drop(p_in, IP6DROP_HLIM_ZERO);
 		return;
 	}
 
-	bool loop_break = false;
-	while(!loop_break) {
-		  header = reinterpret_cast <const click_ip6_header_ext *>( p_in->data() + pace);
-
-		  switch(cur_hdr_ext){
-		  case 6:	//TCP header
-			  click_chatter("TCP Packet - No routing header exists\n");
-			  checked_output_push(0, p_in);
-			  return;
-		  case 17:	//UDP header
-			  click_chatter("UDP Packet - No routing header exists\n");
-			  checked_output_push(0, p_in);
-			  return;
-		  case 58:	//ICMP header
-			  click_chatter("ICMP Packet - No routing header exists\n");
-			  checked_output_push(0, p_in);
-			  return;
-		  case 0:	//Hop by Hop Header
-			  header_length = header->ip6_hdr_length;
-			  pace = pace + (header_length + 1) * 8;
-			  cur_hdr_ext = header->ip6_nxt_hdr;
-			  break;
-		  case 60: 	//Destination header
-			  header_length = header->ip6_hdr_length;
-			  pace = pace + (header_length + 1) * 8;
-			  cur_hdr_ext = header->ip6_nxt_hdr;
-			  break;
-		  case 43:	//Routing Header
-			  r_type = header->routing_type;
-			  if(r_type != 0) {
-				  click_chatter("Error. Routing Type is %d. IP6Routing element only supports Routing Type 0.\n", r_type);
-				  //push out this packet
-				  checked_output_push(0, p_in);
-				  return;
-			  }
-
-			  header_length = header->ip6_hdr_length;
-			  if((header_length % 2) != 0) {
-				  click_chatter("Error. Routing Header Length (%d) is an odd number. \n", header_length);
-				  //drop the packet
-				  return;
-			  }
-			  /*
-			   * The length of routing header is in 8-byte unit except the first 8 bytes
-			   * The length of IPv6 address is 16 bytes so
-			   * ==> number of addresses is equal (header length)/2
-			   */
-			  number_of_addresses = header_length/2;
-			  if(number_of_addresses > 23) {	//maximum number of addresses is 23
-				  click_chatter("Error. The number of addresses in Routing Header exceeds 23.\n");
-				  //drop this packet
-				  return;
-			  }
-
-			  seg_left = header->segment_left;
-			  if(seg_left == 0){	//this is the final destination
-				  checked_output_push(0, p_in);
-				  return;
-			  }
-
-			  //make input packet writable
-			  p = p_in->uniqueify();
-			  ip = reinterpret_cast <click_ip6 *>( p->data() + _offset);
-
-			  //decrease the hop limit
-			  ip->ip6_hlim = hll - 1;
-
-			  //swap current destination address with (N-segment + 1)-th address in header
-			  swap_pos = pace + 8 + (number_of_addresses - seg_left)*sizeof(click_in6_addr);
-			  cur_dst_addr = ip_in->ip6_dst;
-			  //p->data() + 24 maps to location of destination address
-			  memcpy(p->data() + 24, p->data() + swap_pos, sizeof(click_in6_addr));
-			  //Note: the length of fixed part in type 0 routing header is 8 bytes
-			  memcpy(p->data() + pace + 8 + swap_pos*sizeof(click_in6_addr), &cur_dst_addr, sizeof(click_in6_addr));
-
-			  //decrease segment left field
-			  seg_left--;
-			  out_header = reinterpret_cast <click_ip6_header_ext *>( p->data() + pace);
-			  out_header->ip6_routing_extension._segment_left = seg_left;
-			  //in this case, no need to process reserved bits and strict/loose Bit Map
-			  checked_output_push(0, p);	//push out packet
-			  return;
-		  case 44: 	//fragment header
-			  pace = pace + 8;		//Fragment header has fixed length of 8bytes
-			  cur_hdr_ext = header->ip6_nxt_hdr;
-			  break;
-		  case 50: 	//ESP
-			  header_length = header->ip6_hdr_length;
-			  pace = pace + (header_length + 2) * 4;	//Length of ESP is calculated in 4bytes block except the first 8bytes
-			  cur_hdr_ext = header->ip6_nxt_hdr;
-			  break;
-		  case 51: 	//Authentication header
-			  checked_output_push(0, p_in);
-			  return;	//do nothing
-		  case 59:	//no header
-			  checked_output_push(0, p_in);
-			  return; 	//do nothing
-		  case 41:	//Encapsulating header
-			  checked_output_push(0, p_in);
-			  return; //do nothing
-		  default:	//unknown IP6 header extension
-			  click_chatter("Header Type (%d) is unrecognized.\n", cur_hdr_ext);
-			  checked_output_push(0, p_in);
-			  return;
-		  }
-	  }
+	ip6_ext_get(p_in, _offset, info);
+	if (!info.routing) {
+		//no routing header, or it lies behind ESP or an unknown header
+		_stats.emit(this, 0, p_in, IP6DROP_NO_OUTPUT);
+		return;
+	}
+	pace = info.routing;
+	if (info.flags & ip6_ext_info::F_TRUNCATED) {
+		if (unlikely(_trace.enabled()))
+			_trace.record(IP6TRACE_RH_TRUNCATED, pace);
+		_stats.drop(p_in, IP6DROP_RH_TRUNCATED);
+		return;
+	}
+	header = reinterpret_cast <const click_ip6_header_ext *>( p_in->data() + _offset + pace);
+
+	r_type = header->routing_type;
+	if(r_type != 0) {
+		if (unlikely(_trace.enabled()))
+			_trace.record(IP6TRACE_RH_TYPE, r_type);
+		//push out this packet
+		_stats.emit(this, 0, p_in, IP6DROP_NO_OUTPUT);
+		return;
+	}
+
+	header_length = header->ip6_hdr_length;
+	if((header_length % 2) != 0) {
+		if (unlikely(_trace.enabled()))
+			_trace.record(IP6TRACE_RH_ODD_LENGTH, header_length);
+		//drop the packet
+		_stats.drop(p_in, IP6DROP_RH_ODD_LENGTH);
+		return;
+	}
+	/*
+	 * The length of routing header is in 8-byte unit except the first 8 bytes
+	 * The length of IPv6 address is 16 bytes so
+	 * ==> number of addresses is equal (header length)/2
+	 */
+	number_of_addresses = header_length/2;
+	if(number_of_addresses > 23) {	//maximum number of addresses is 23
+		if (unlikely(_trace.enabled()))
+			_trace.record(IP6TRACE_RH_ADDRESSES, number_of_addresses);
+		//drop this packet
+		_stats.drop(p_in, IP6DROP_RH_ADDRESSES);
+		return;
+	}
+
+	//the addresses must lie within the packet before any is touched
+	if (_offset + pace + 8 + number_of_addresses*sizeof(click_in6_addr) > p_in->length()) {
+		if (unlikely(_trace.enabled()))
+			_trace.record(IP6TRACE_RH_TRUNCATED, pace);
+		_stats.drop(p_in, IP6DROP_RH_TRUNCATED);
+		return;
+	}
+
+	seg_left = header->segment_left;
+	if(seg_left == 0){	//this is the final destination
+		_stats.emit(this, 0, p_in, IP6DROP_NO_OUTPUT);
+		return;
+	}
+	if (seg_left > number_of_addresses) {
+		//RFC 8200 asks for a Parameter Problem pointing at Segments Left
+		if (unlikely(_trace.enabled()))
+			_trace.record(IP6TRACE_RH_SEGMENTS_LEFT, seg_left);
+		_stats.emit(this, 1, p_in, IP6DROP_RH_SEGMENTS_LEFT);
+		return;
+	}
+
+	//make input packet writable
+	cur_dst_addr = ip_in->ip6_dst;
+	p = p_in->uniqueify();
+	if (!p) {
+		//uniqueify() freed the packet
+		_stats.drop(IP6DROP_NO_MEMORY);
+		return;
+	}
+	ip = reinterpret_cast <click_ip6 *>( p->data() + _offset);
+
+	//decrease the hop limit
+	ip->ip6_hlim = hll - 1;
+
+	//swap current destination address with (N-segment + 1)-th address in header
+	//Note: the length of fixed part in type 0 routing header is 8 bytes
+	swap_pos = _offset + pace + 8 + (number_of_addresses - seg_left)*sizeof(click_in6_addr);
+	memcpy(&ip->ip6_dst, p->data() + swap_pos, sizeof(click_in6_addr));
+	memcpy(p->data() + swap_pos, &cur_dst_addr, sizeof(click_in6_addr));
+
+	//decrease segment left field
+	seg_left--;
+	out_header = reinterpret_cast <click_ip6_header_ext *>( p->data() + _offset + pace);
+	out_header->ip6_routing_extension._segment_left = seg_left;
+	//in this case, no need to process reserved bits and strict/loose Bit Map
+	if (unlikely(_trace.enabled()))
+		_trace.record(IP6TRACE_RH_FORWARD, seg_left);
+	_stats.emit(this, 0, p, IP6DROP_NO_OUTPUT);	//push out packet
 }
 
 
 void
 IP6Routing::add_handlers() {
-
+	_trace.add_handlers(this);
+	_stats.add_handlers(this);
 }
 
 
 void
 IP6Routing::push(int, Packet *p) {
-  click_chatter("IP6Routing::push, packet length is %d \n", p->ip_header_length());
+  _stats.profile_start();
   routing(p);
 }
 
@@ -2,42 +2,42 @@
 #define CLICK_IP6ROUTING_HH
 #include <click/element.hh>
 #include <click/glue.hh>
+#include "ip6trace.hh"
+#include "ip6stats.hh"
 CLICK_DECLS
 
 /*
  * =c
- * IP6Fragmenter(MTU)
+ * IP6Routing([I<keywords> TRACE, TRACE_RATE])
  * =s ip6
  *
  * =d
- * Expects IP6 packets as input.
- * If the IP6 packet size is <= mtu, just emits the packet on output 0.
- * If the size is greater than mtu and DF isn't set, splits into
- * fragments emitted on output 0.
- * If DF is set and size is greater than mtu, sends to output 1.
+ * Expects IP6 packets as input. Packets with a type 0 routing header and
+ * segments left are sent to the next address it lists, swapped with the
+ * destination, their hop limit decreased; every other packet is emitted on
+ * output 0 as it is.
  *
- * Ordinarily output 1 is connected to an ICMP6Error packet generator
- * with type 3 (UNREACH) and code 4 (NEEDFRAG).
- *
- * Only the mac_broadcast annotation is copied into the fragments.
- *
- * Sends the first fragment last.
+ * Packets whose routing header runs past the end of the packet, lists more
+ * than 23 addresses or has an odd length are dropped. Packets with more
+ * segments left than addresses are sent to output 1, if present, for
+ * ICMP6Error to answer with a Parameter Problem (RFC 8200), and dropped
+ * otherwise.
  *
  * =e
- * Example:
  *
- *   ... -> fr::IP6Fragmenter -> Queue(20) -> ...
- *   fr[1] -> ICMP6Error(18.26.4.24, 3, 4) -> ...
+ *   ... -> rt :: IP6Routing -> ...
+ *   rt[1] -> ICMP6Error(2001:db8::1, 4, 0) -> ...
  *
- * =a ICMP6Error, CheckLength
+ * =a IP6HopByHop, ICMP6Error
  */
 
 class IP6Routing : public Element {
 
   unsigned _mtu;
   unsigned _headroom;
-  uint32_t _drops;
   uint32_t _fragments;
+  IP6Trace _trace;
+  IP6Stats _stats;
 
  public:
 
@@ -49,7 +49,7 @@ class IP6Routing : public Element {
   const char *processing() const		{ return PUSH; }
   int configure(Vector<String> &, ErrorHandler *);
 
-  int drops() const				{ return _drops; }
+  uint64_t drops() const			{ return _stats.drops(); }
 
   void add_handlers();
   void routing(Packet *p_in);
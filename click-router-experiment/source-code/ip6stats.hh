@@ -0,0 +1,197 @@
+#ifndef CLICK_IP6STATS_HH
+#define CLICK_IP6STATS_HH
+#include <click/element.hh>
+#include <click/glue.hh>
+#include <click/handler.hh>
+#include <click/straccum.hh>
+#include "ip6profile.hh"
+CLICK_DECLS
+
+/*
+ * Counters of the IP6 elements: packets and bytes sent on each output, and
+ * packets dropped for each reason below.
+ *
+ * Every thread counts in its own block, starting on a cache line of its own,
+ * so counting is a plain increment that never contends. Handlers add up the
+ * blocks of all threads when read.
+ *
+ * Elements call configure() once their outputs are known, count with
+ * emit() and drop(), and add the handlers port_counts, drop_counts, drops
+ * and reset with add_handlers(). When profiling is compiled in, they also
+ * call profile_start() as push() begins, and get the handlers of IP6Profile.
+ */
+
+/*Drop reasons, named by ip6_drop_names*/
+enum{
+	IP6DROP_HLIM_ZERO = 0,		//hop limit was zero
+	IP6DROP_RH_ODD_LENGTH,		//routing header length not a multiple of 16 bytes
+	IP6DROP_RH_ADDRESSES,		//more than 23 addresses in a routing header
+	IP6DROP_RH_SEGMENTS_LEFT,	//more segments left than addresses, and no output for it
+	IP6DROP_RH_TRUNCATED,		//routing header runs past the end of the packet
+	IP6DROP_HBH_TRUNCATED,		//hop by hop header or option runs past its end
+	IP6DROP_BAD_JUMBO,			//bad Jumbo Payload option and no output for it
+	IP6DROP_UNKNOWN_HEADER,		//unknown option whose type says to discard the packet
+	IP6DROP_NO_MATCH,			//matched no pattern and no output for it
+	IP6DROP_NO_MEMORY,			//packet could not be copied or cloned
+	IP6DROP_NO_OUTPUT,			//sent to an output that does not exist
+	IP6DROP_FRAG_BAD,			//malformed fragment, or one past the end of its datagram
+	IP6DROP_FRAG_TINY,			//fragment too small, or one too many for its datagram
+	IP6DROP_FRAG_OVERLAP,		//fragment of a datagram abandoned for overlapping fragments
+	IP6DROP_FRAG_DUPLICATE,		//exact duplicate of a fragment held
+	IP6DROP_FRAG_TIMEOUT,		//fragment of a datagram not reassembled in time
+	IP6DROP_FRAG_EVICTED,		//fragment of a datagram evicted to stay within memory
+	IP6DROP_PTB_BAD,			//malformed Packet Too Big, or one reporting less than 1280 bytes
+	IP6DROP_TCP_BAD,			//TCP header truncated or past the payload length
+	IP6DROP_LENGTH_BAD,			//payload length past the end of the packet, or short of its headers
+	IP6DROP_COUNT
+};
+
+static const char * const ip6_drop_names[IP6DROP_COUNT] = {
+	"hop-limit-zero", "rh-odd-length", "rh-addresses", "rh-segments-left",
+	"rh-truncated", "hbh-truncated", "bad-jumbo",
+	"unknown-header", "no-match", "no-memory", "no-output", "frag-bad",
+	"frag-tiny", "frag-overlap", "frag-duplicate", "frag-timeout", "frag-evicted",
+	"ptb-bad", "tcp-bad", "length-bad"
+};
+
+class IP6Stats{ public:
+
+	IP6Stats() : _memory(0), _blocks(0), _nblocks(0), _nports(0), _stride(0) {}
+	~IP6Stats()					{ delete[] _memory; }
+
+	/*Allocates the counters of nports outputs, all zero*/
+	void configure(int nports){
+		delete[] _memory;
+		_nports = nports;
+		//packets and bytes of every port, then the drops, rounded up to cache lines
+		_stride = (2 * nports + IP6DROP_COUNT + 7) & ~7;
+		_nblocks = click_max_cpu_ids();
+		_memory = new uint64_t[_nblocks * _stride + 7];
+		_blocks = reinterpret_cast<uint64_t *>((reinterpret_cast<uintptr_t>(_memory) + 63) & ~(uintptr_t) 63);
+		memset(_blocks, 0, _nblocks * _stride * sizeof(uint64_t));
+#if IP6_PROFILE
+		_profile.configure(nports);
+#endif
+	}
+
+	void add_handlers(Element *e){
+		e->add_read_handler("port_counts", read_port_counts, this);
+		e->add_read_handler("drop_counts", read_drop_counts, this);
+		e->add_read_handler("drops", read_drops, this);
+		e->add_write_handler("reset", reset_handler, this, Handler::BUTTON);
+#if IP6_PROFILE
+		_profile.add_handlers(e);
+#endif
+	}
+
+	inline void profile_start(){
+#if IP6_PROFILE
+		_profile.start();
+#endif
+	}
+
+	/*Counts p and pushes it to output port of e, or drops it if the port
+	 * does not exist*/
+	inline void emit(Element *e, int port, Packet *p, int reason){
+		if (port < _nports) {
+			uint64_t *c = block();
+			c[port]++;
+			c[_nports + port] += p->length();
+#if IP6_PROFILE
+			_profile.sample(port);
+			e->output(port).push(p);
+			//the elements downstream do not count
+			_profile.start();
+#else
+			e->output(port).push(p);
+#endif
+		} else {
+			drop(p, reason);
+		}
+	}
+
+	inline void drop(Packet *p, int reason){
+		block()[2 * _nports + reason]++;
+#if IP6_PROFILE
+		_profile.sample(_nports);
+#endif
+		p->kill();
+	}
+
+	/*Counts a drop of a packet already freed*/
+	inline void drop(int reason){
+		block()[2 * _nports + reason]++;
+	}
+
+	uint64_t drops() const{
+		uint64_t n = 0;
+		for (int r = 0; r < IP6DROP_COUNT; r++) {
+			n += sum(2 * _nports + r);
+		}
+		return n;
+	}
+
+ private:
+
+	uint64_t *_memory;
+	uint64_t *_blocks;		//_memory aligned on a cache line
+	unsigned _nblocks;
+	int _nports;
+	int _stride;			//counters per thread
+#if IP6_PROFILE
+	IP6Profile _profile;
+#endif
+
+	inline uint64_t *block(){
+		return _blocks + click_current_cpu_id() * _stride;
+	}
+
+	uint64_t sum(int index) const{
+		uint64_t n = 0;
+		for (unsigned i = 0; i < _nblocks; i++) {
+			n += __atomic_load_n(&_blocks[i * _stride + index], __ATOMIC_RELAXED);
+		}
+		return n;
+	}
+
+	/*One line per output: port, packets, bytes*/
+	static String read_port_counts(Element *, void *thunk){
+		const IP6Stats *s = static_cast<const IP6Stats *>(thunk);
+		StringAccum sa;
+		for (int port = 0; port < s->_nports; port++) {
+			sa << port << ' ' << s->sum(port) << ' ' << s->sum(s->_nports + port) << '\n';
+		}
+		return sa.take_string();
+	}
+
+	/*One line per reason: name, packets*/
+	static String read_drop_counts(Element *, void *thunk){
+		const IP6Stats *s = static_cast<const IP6Stats *>(thunk);
+		StringAccum sa;
+		for (int r = 0; r < IP6DROP_COUNT; r++) {
+			sa << ip6_drop_names[r] << ' ' << s->sum(2 * s->_nports + r) << '\n';
+		}
+		return sa.take_string();
+	}
+
+	static String read_drops(Element *, void *thunk){
+		return String(static_cast<const IP6Stats *>(thunk)->drops());
+	}
+
+	/*Zeroes every counter and profile. Packets counted by other threads meanwhile may be
+	 * lost from the counts*/
+	static int reset_handler(const String &, Element *, void *thunk, ErrorHandler *){
+		IP6Stats *s = static_cast<IP6Stats *>(thunk);
+		for (unsigned i = 0; i < s->_nblocks * s->_stride; i++) {
+			__atomic_store_n(&s->_blocks[i], 0, __ATOMIC_RELAXED);
+		}
+#if IP6_PROFILE
+		s->_profile.clear();
+#endif
+		return 0;
+	}
+
+};
+
+CLICK_ENDDECLS
+#endif
@@ -0,0 +1,266 @@
+/*
+ * ip6tcpsegmenter.{cc,hh} -- element splits large IP6 TCP packets into segments
+ */
+
+#include <click/config.h>
+#include "ip6tcpsegmenter.hh"
+#include "ip6extparse.hh"
+#include <clicknet/ip6.h>
+#include <clicknet/tcp.h>
+#include <click/args.hh>
+#include <click/error.hh>
+#include <click/glue.hh>
+CLICK_DECLS
+
+IP6TCPSegmenter::IP6TCPSegmenter()
+  : _mss(0), _headroom(Packet::default_headroom), _segments(0), _pool(0)
+{
+}
+
+IP6TCPSegmenter::~IP6TCPSegmenter()
+{
+    if (_pool)
+	_pool->orphan();
+}
+
+int
+IP6TCPSegmenter::configure(Vector<String> &conf, ErrorHandler *errh)
+{
+    uint32_t pool = 256;
+    if (Args(conf, this, errh)
+	.read_mp("MSS", _mss)
+	.read("POOL", pool)
+	.complete() < 0)
+	return -1;
+    if (_mss < 1 || _mss > 65535)
+	return errh->error("MSS must be 1 to 65535");
+    _pool = new IP6FragPool(_headroom + HEADERS_MAX + _mss, pool);
+    _stats.configure(noutputs());
+    return 0;
+}
+
+/*What the segments of one packet share*/
+struct tcp_segments{
+	int l4;					//offset of the TCP header
+	int hlen;				//headers, up to the end of the TCP header
+	int dlen;				//data of the packet
+	int jumbo;				//offset of the Jumbo Payload option, 0 if none
+	uint32_t seq;
+	uint32_t urp;			//0 if URG is not set
+	uint8_t flags;
+	uint64_t header_sum;	//TCP header without seq, flags, checksum and urp
+	click_in6_addr src;
+	click_in6_addr dst;		//of the pseudo header
+};
+
+/*The 32-bit word of a TCP header holding its flags, with the other bytes
+ * zero, as in memory*/
+static inline uint32_t
+flags_word(uint8_t flags){
+	unsigned char w[4] = { 0, flags, 0, 0 };
+	uint32_t x;
+	memcpy(&x, w, 4);
+	return x;
+}
+
+/*Sets the payload length and TCP header of q, holding len bytes of data at
+ * offset, and sums its checksum from the header sum of the packet*/
+static void
+finish_segment(WritablePacket *q, const tcp_segments &ts, int offset, int len){
+	uint8_t f = ts.flags;
+	if (offset + len < ts.dlen) {
+		f &= ~(TH_FIN | TH_PUSH);
+	}
+	if (offset > 0) {
+		f &= ~TH_CWR;
+	}
+	uint16_t urp = 0;
+	if (ts.urp > (uint32_t) offset) {
+		urp = ts.urp - offset;
+	} else {
+		f &= ~TH_URG;
+	}
+	unsigned char *d = q->data();
+	if (ts.jumbo) {
+		ip6_jumbo_clear(d, ts.jumbo);
+	}
+	reinterpret_cast<click_ip6 *>(d)->ip6_plen = htons(ts.hlen - sizeof(click_ip6) + len);
+	click_tcp *th = reinterpret_cast<click_tcp *>(d + ts.l4);
+	th->th_seq = htonl(ts.seq + offset);
+	th->th_flags = f;
+	th->th_sum = 0;
+	th->th_urp = htons(urp);
+	//the words changed, as in memory, added to the sum of the others
+	uint32_t seq_word, urp_word;
+	memcpy(&seq_word, &th->th_seq, 4);
+	memcpy(&urp_word, &th->th_sum, 4);
+	uint64_t sum = ts.header_sum + seq_word + flags_word(f) + urp_word;
+	sum = in6_cksum_add(d + ts.hlen, len, sum);
+	th->th_sum = in6_cksum_finish(&ts.src, &ts.dst, htons(ts.hlen - ts.l4 + len), IP_PROTO_TCP, sum);
+}
+
+/*Copies the headers of p, its first hlen bytes, and len bytes of its data
+ * at offset*/
+WritablePacket *
+IP6TCPSegmenter::copy_segment(Packet *p, int hlen, int offset, int len)
+{
+	WritablePacket *q = _pool->make(_headroom, hlen + len);
+	if (!q) {
+		return 0;
+	}
+	memcpy(q->data(), p->data(), hlen);
+	memcpy(q->data() + hlen, p->data() + hlen + offset, len);
+	q->set_network_header(q->data(), sizeof(click_ip6));
+	q->copy_annotations(p);
+	return q;
+}
+
+/*
+ * Splits p, whose headers end at hlen and which carries dlen bytes of data,
+ * into segments of mss bytes. jumbo is as in tcp_segments.
+ * The segments after the first are copied first and chained; the first one
+ * is then cut out of p itself and emitted ahead of them, so the segments
+ * leave in sequence order.
+ */
+void
+IP6TCPSegmenter::segment(Packet *p, const ip6_ext_info &info, int hlen, int dlen, int mss, int jumbo)
+{
+	const unsigned char *data = p->data();
+	const click_tcp *th = reinterpret_cast<const click_tcp *>(data + info.l4);
+	tcp_segments ts;
+	ts.l4 = info.l4;
+	ts.hlen = hlen;
+	ts.dlen = dlen;
+	ts.jumbo = jumbo;
+	ts.seq = ntohl(th->th_seq);
+	ts.flags = th->th_flags;
+	ts.urp = (th->th_flags & TH_URG) ? ntohs(th->th_urp) : 0;
+	ts.src = reinterpret_cast<const click_ip6 *>(data)->ip6_src;
+	ts.dst = *ip6_final_destination(data, info);
+
+	//the TCP header is summed once for all segments
+	unsigned char tcp[60];
+	memcpy(tcp, th, hlen - info.l4);
+	click_tcp *t = reinterpret_cast<click_tcp *>(tcp);
+	t->th_seq = 0;
+	t->th_flags = 0;
+	t->th_sum = 0;
+	t->th_urp = 0;
+	ts.header_sum = in6_cksum_add(tcp, hlen - info.l4, 0);
+
+	Packet *head = 0, *last = 0;
+	bool complete = true;
+	for (int offset = mss; offset < dlen; offset += mss) {
+		int len = dlen - offset < mss ? dlen - offset : mss;
+		WritablePacket *q = copy_segment(p, hlen, offset, len);
+		if (!q) {
+			complete = false;
+			break;
+		}
+		finish_segment(q, ts, offset, len);
+		if (last) {
+			last->set_next(q);
+		} else {
+			head = q;
+		}
+		last = q;
+		q->set_next(0);
+	}
+
+	WritablePacket *first = 0;
+	if (complete) {
+		if (p->shared()) {
+			//uniqueify() would copy all of it
+			first = copy_segment(p, hlen, 0, mss);
+			p->kill();
+		} else {
+			first = p->uniqueify();
+			first->take(first->length() - (hlen + mss));
+		}
+	} else {
+		p->kill();
+	}
+	if (!first) {
+		//a segment missing: the others would only make holes
+		while (head) {
+			Packet *next = head->next();
+			head->kill();
+			head = next;
+		}
+		_stats.drop(IP6DROP_NO_MEMORY);
+		return;
+	}
+	finish_segment(first, ts, 0, mss);
+	_segments++;
+	_stats.emit(this, 0, first, IP6DROP_NO_OUTPUT);
+	while (head) {
+		Packet *next = head->next();
+		head->set_next(0);
+		_segments++;
+		_stats.emit(this, 0, head, IP6DROP_NO_OUTPUT);
+		head = next;
+	}
+}
+
+void
+IP6TCPSegmenter::push(int, Packet *p)
+{
+	_stats.profile_start();
+	ip6_ext_info info;
+	ip6_ext_get(p, 0, info);
+	if (info.proto != IP_PROTO_TCP || !info.l4 || info.frag) {
+		_stats.emit(this, 0, p, IP6DROP_NO_OUTPUT);
+		return;
+	}
+	const unsigned char *data = p->data();
+	const click_ip6 *ip = reinterpret_cast<const click_ip6 *>(data);
+	int jumbo = ip->ip6_plen ? 0 : ip6_jumbo_option(data, p->length(), info);
+	uint32_t end = sizeof(click_ip6) + ip6_payload_length(data, jumbo);
+	const click_tcp *th = reinterpret_cast<const click_tcp *>(data + info.l4);
+	if (info.l4 + sizeof(click_tcp) > end || end > p->length()
+	    || th->th_off < 5 || info.l4 + th->th_off * 4U > end) {
+		_stats.emit(this, 1, p, IP6DROP_TCP_BAD);
+		return;
+	}
+	int hlen = info.l4 + th->th_off * 4;
+	int dlen = end - hlen;
+	//the segments of a jumbogram are ordinary packets: their payload
+	//length must fit in 16 bits
+	int mss = _mss;
+	if (jumbo && hlen - (int) sizeof(click_ip6) + mss > 65535) {
+		mss = 65535 - (hlen - sizeof(click_ip6));
+	}
+	if (dlen <= mss || (th->th_flags & (TH_SYN | TH_RST))) {
+		_stats.emit(this, 0, p, IP6DROP_NO_OUTPUT);
+		return;
+	}
+	segment(p, info, hlen, dlen, mss, jumbo);
+}
+
+enum { H_SEGMENTS, H_POOL_ALLOCATIONS };
+
+String
+IP6TCPSegmenter::read_handler(Element *e, void *thunk)
+{
+	IP6TCPSegmenter *s = static_cast<IP6TCPSegmenter *>(e);
+	switch ((intptr_t) thunk) {
+	case H_SEGMENTS:
+		return String(s->_segments);
+	case H_POOL_ALLOCATIONS:
+		return String(s->_pool->allocations());
+	default:
+		return String();
+	}
+}
+
+void
+IP6TCPSegmenter::add_handlers()
+{
+	add_read_handler("segments", read_handler, H_SEGMENTS);
+	add_read_handler("pool_allocations", read_handler, H_POOL_ALLOCATIONS);
+	_stats.add_handlers(this);
+}
+
+CLICK_ENDDECLS
+ELEMENT_REQUIRES(IP6Cksum)
+EXPORT_ELEMENT(IP6TCPSegmenter)
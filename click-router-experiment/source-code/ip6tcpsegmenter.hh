@@ -0,0 +1,121 @@
+#ifndef CLICK_IP6TCPSEGMENTER_HH
+#define CLICK_IP6TCPSEGMENTER_HH
+#include <click/element.hh>
+#include <click/glue.hh>
+#include "ip6stats.hh"
+#include "ip6extparse.hh"
+#include "ip6fragpool.hh"
+CLICK_DECLS
+
+/*
+ * =c
+ * IP6TCPSegmenter(MSS [, I<keywords> POOL])
+ * =s ip6
+ *
+ * =d
+ * Expects IP6 packets as input. Splits TCP packets carrying more than MSS
+ * bytes of data into segments of MSS bytes, the last one excepted, emitted
+ * on output 0 in sequence order. Receivers get ordinary TCP segments instead
+ * of fragments to reassemble.
+ *
+ * Every segment carries the headers of the packet, up to and including the
+ * TCP header with its options, and its slice of the data. Its sequence
+ * number is advanced past the data before it; FIN and PSH are kept in the
+ * last segment only, CWR in the first one only, and URG in the segments
+ * the urgent pointer reaches, the pointer made relative to each. The TCP
+ * header is summed once per packet; the checksum of each segment then adds
+ * the fields it changes and its data. When a routing header lists more
+ * segments, the checksum names the final destination.
+ *
+ * Jumbograms (RFC 2675) are split alike, into ordinary packets: the Jumbo
+ * Payload option of each segment is turned into padding and its payload
+ * length set, and MSS is lowered, if need be, for the headers and data to
+ * fit in 65535 bytes. So a jumbogram can leave on a link of common MTU.
+ *
+ * Other packets are emitted on output 0 unchanged: packets that are not
+ * TCP, fragments, TCP packets that fit in MSS, and SYN or RST packets. TCP
+ * packets whose header is truncated or runs past the payload length are
+ * sent to output 1, if present, and dropped otherwise.
+ *
+ * The first segment is the packet itself, cut short, so its data is not
+ * copied unless the packet is shared. The other segments are copies of the
+ * headers and their slice of the data, in buffers of a per-thread pool as
+ * in IP6Fragmenter.
+ *
+ * Keyword arguments are:
+ *
+ * =over 8
+ *
+ * =item POOL
+ *
+ * Unsigned integer. Segment buffers allocated at configuration; more are
+ * allocated 32 at a time when needed. Default is 256.
+ *
+ * =back
+ *
+ * =h segments read-only
+ *
+ * Segments emitted by splitting packets.
+ *
+ * =h pool_allocations read-only
+ *
+ * Allocations made by the segment buffer pool, each for 32 buffers.
+ *
+ * =h port_counts read-only
+ *
+ * Packets and bytes sent on each output, one line per output.
+ *
+ * =h drop_counts read-only
+ *
+ * Packets dropped for each reason, one line per reason.
+ *
+ * =h drops read-only
+ *
+ * Packets dropped.
+ *
+ * =h reset write-only
+ *
+ * Zeroes the counters of port_counts and drop_counts.
+ *
+ * =e
+ * Segments TCP to 1440 bytes of data, and fragments what is left:
+ *
+ *   ... -> IP6TCPSegmenter(1440) -> fr::IP6Fragmenter(1500) -> ...
+ *
+ * =a IP6Fragmenter */
+
+class IP6TCPSegmenter : public Element {
+
+  enum{
+	  HEADERS_MAX = 256		//headers in a pool buffer besides the data
+  };
+
+  uint32_t _mss;
+  unsigned _headroom;
+  uint64_t _segments;
+  IP6Stats _stats;
+  IP6FragPool *_pool;
+
+  void segment(Packet *p, const ip6_ext_info &info, int hlen, int dlen, int mss, int jumbo);
+  WritablePacket *copy_segment(Packet *p, int hlen, int offset, int len);
+
+  static String read_handler(Element *e, void *thunk);
+
+ public:
+
+  IP6TCPSegmenter();
+  ~IP6TCPSegmenter();
+
+  const char *class_name() const		{ return "IP6TCPSegmenter"; }
+  const char *port_count() const		{ return PORTS_1_1X2; }
+  const char *processing() const		{ return PUSH; }
+  int configure(Vector<String> &, ErrorHandler *);
+
+  void add_handlers();
+
+  void push(int, Packet *p);
+
+};
+
+CLICK_ENDDECLS
+#endif
@@ -0,0 +1,179 @@
+#ifndef CLICK_IP6TRACE_HH
+#define CLICK_IP6TRACE_HH
+#include <click/element.hh>
+#include <click/glue.hh>
+#include <click/args.hh>
+#include <click/confparse.hh>
+#include <click/straccum.hh>
+#include <click/timestamp.hh>
+CLICK_DECLS
+
+/*
+ * Trace of the unusual packets seen by the IP6 elements.
+ *
+ * Instead of printing a line, an element records an event: a code from the
+ * list below and one number. Tracing is off by default; recording then costs
+ * one well predicted branch. When it is on, every thread appends to its own
+ * ring of IP6TRACE_SIZE events, without locks, and keeps at most rate events
+ * per second, only counting the others. Nothing is printed by the data path
+ * either way: the trace_dump handler formats the rings when read.
+ *
+ * Elements add the keywords TRACE and TRACE_RATE with configure() and the
+ * handlers trace and trace_dump with add_handlers().
+ */
+
+enum{ IP6TRACE_SIZE = 64 };		//events kept per thread, a power of 2
+
+/*Event codes, named by ip6_trace_names*/
+enum{
+	IP6TRACE_HLIM_ZERO = 0,			//arg: payload length
+	IP6TRACE_HBH_ROUTER_ALERT,		//malformed Router Alert option; arg: option length
+	IP6TRACE_HBH_JUMBO_ALIGN,		//misaligned Jumbo Payload option; arg: option offset
+	IP6TRACE_HBH_JUMBO_LENGTH,		//arg: Jumbo Payload option length
+	IP6TRACE_HBH_JUMBO_SHORT,		//arg: jumbo payload length
+	IP6TRACE_HBH_JUMBO_PLEN,		//jumbogram with a payload length; arg: payload length
+	IP6TRACE_HBH_JUMBO_TRUNCATED,	//jumbogram shorter than its jumbo length; arg: jumbo length
+	IP6TRACE_HBH_JUMBO_FRAG,		//jumbogram with a Fragment header; arg: its offset
+	IP6TRACE_HBH_UNKNOWN_OPTION,	//arg: option type
+	IP6TRACE_HBH_TRUNCATED,			//option past the header; arg: its offset, 0 for the header
+	IP6TRACE_RH_TYPE,				//unsupported routing type; arg: routing type
+	IP6TRACE_RH_ODD_LENGTH,			//arg: header length
+	IP6TRACE_RH_ADDRESSES,			//more than 23 addresses; arg: number of addresses
+	IP6TRACE_RH_SEGMENTS_LEFT,		//more segments left than addresses; arg: segments left
+	IP6TRACE_RH_TRUNCATED,			//arg: offset of the routing header
+	IP6TRACE_RH_FORWARD,			//routed to the next segment; arg: segments left
+	IP6TRACE_NO_MATCH,				//matched no pattern; arg: upper layer protocol, 255 if none
+	IP6TRACE_NO_MATCH_DROP,			//unmatched and no output for it; arg: packet length
+	IP6TRACE_FRAG_BAD,				//malformed fragment; arg: fragment offset
+	IP6TRACE_FRAG_TINY,				//arg: fragment data length
+	IP6TRACE_FRAG_OVERLAP,			//datagram abandoned; arg: fragment offset
+	IP6TRACE_COUNT
+};
+
+static const char * const ip6_trace_names[IP6TRACE_COUNT] = {
+	"hop-limit-zero", "hbh-router-alert", "hbh-jumbo-align", "hbh-jumbo-length",
+	"hbh-jumbo-short", "hbh-jumbo-plen", "hbh-jumbo-truncated", "hbh-jumbo-frag",
+	"hbh-unknown-option", "hbh-truncated", "rh-type",
+	"rh-odd-length", "rh-addresses", "rh-segments-left", "rh-truncated", "rh-forward", "no-match", "no-match-drop",
+	"frag-bad", "frag-tiny", "frag-overlap"
+};
+
+struct ip6_trace_event{
+	click_jiffies_t when;
+	uint32_t code;
+	uint32_t arg;
+};
+
+class IP6Trace{ public:
+
+	IP6Trace() : _rings(0), _nrings(0), _rate(100), _enabled(false) {}
+	~IP6Trace()					{ delete[] _rings; }
+
+	/*Reads the TRACE and TRACE_RATE keywords from conf*/
+	int configure(Vector<String> &conf, Element *e, ErrorHandler *errh){
+		bool enabled = false;
+		uint32_t rate = 100;
+		if (Args(e, errh).bind(conf)
+			.read("TRACE", enabled)
+			.read("TRACE_RATE", rate)
+			.consume() < 0)
+			return -1;
+		if (!_rings) {
+			_nrings = click_max_cpu_ids();
+			_rings = new ring[_nrings];
+			memset(_rings, 0, _nrings * sizeof(ring));
+		}
+		_rate = rate;
+		_enabled = enabled;
+		return 0;
+	}
+
+	void add_handlers(Element *e){
+		e->add_read_handler("trace", read_handler, this);
+		e->add_write_handler("trace", write_handler, this);
+		e->add_read_handler("trace_dump", dump_handler, this);
+	}
+
+	inline bool enabled() const	{ return __atomic_load_n(&_enabled, __ATOMIC_RELAXED); }
+
+	/*Appends an event to the calling thread's ring. Check enabled() first*/
+	void record(int code, uint32_t arg){
+		ring &r = _rings[click_current_cpu_id()];
+		click_jiffies_t now = click_jiffies();
+		click_jiffies_t second = now / CLICK_HZ;
+		if (r.second != second) {
+			r.second = second;
+			r.budget = _rate;
+		}
+		if (r.budget == 0) {
+			r.suppressed++;
+			return;
+		}
+		r.budget--;
+		ip6_trace_event &ev = r.events[r.head & (IP6TRACE_SIZE - 1)];
+		ev.when = now;
+		ev.code = code;
+		ev.arg = arg;
+		//the dump handler reads head from another thread
+		__atomic_store_n(&r.head, r.head + 1, __ATOMIC_RELEASE);
+	}
+
+ private:
+
+	struct ring{
+		uint32_t head;			//events recorded so far
+		uint32_t budget;		//events left this second
+		click_jiffies_t second;
+		uint64_t suppressed;	//events beyond the rate
+		ip6_trace_event events[IP6TRACE_SIZE];
+		char padding[64];		//keeps rings of different threads off one cache line
+	};
+
+	ring *_rings;
+	unsigned _nrings;
+	uint32_t _rate;			//events kept per second per thread
+	bool _enabled;
+
+	static String read_handler(Element *, void *thunk){
+		IP6Trace *t = static_cast<IP6Trace *>(thunk);
+		return String(t->enabled());
+	}
+
+	static int write_handler(const String &s, Element *, void *thunk, ErrorHandler *errh){
+		IP6Trace *t = static_cast<IP6Trace *>(thunk);
+		bool enabled;
+		if (!BoolArg().parse(cp_uncomment(s), enabled)) {
+			return errh->error("trace must be true or false");
+		}
+		__atomic_store_n(&t->_enabled, enabled, __ATOMIC_RELAXED);
+		return 0;
+	}
+
+	/*One line per event, oldest first, thread by thread. Events being
+	 * overwritten while the rings are read may show up garbled*/
+	static String dump_handler(Element *, void *thunk){
+		IP6Trace *t = static_cast<IP6Trace *>(thunk);
+		StringAccum sa;
+		for (unsigned i = 0; i < t->_nrings; i++) {
+			const ring &r = t->_rings[i];
+			uint32_t head = __atomic_load_n(&r.head, __ATOMIC_ACQUIRE);
+			uint32_t first = head > IP6TRACE_SIZE ? head - IP6TRACE_SIZE : 0;
+			for (uint32_t n = first; n < head; n++) {
+				const ip6_trace_event &ev = r.events[n & (IP6TRACE_SIZE - 1)];
+				if (ev.code >= IP6TRACE_COUNT) {
+					continue;
+				}
+				sa << Timestamp::make_jiffies(ev.when) << " cpu " << i << ' '
+				   << ip6_trace_names[ev.code] << ' ' << ev.arg << '\n';
+			}
+			if (r.suppressed) {
+				sa << "cpu " << i << " suppressed " << r.suppressed << '\n';
+			}
+		}
+		return sa.take_string();
+	}
+
+};
+
+CLICK_ENDDECLS
+#endif
@@ -0,0 +1,195 @@
+#!/usr/bin/env python3
+# gen-traces.py -- writes the IP6 traces replayed by ip6replay.click
+#
+#   python3 gen-traces.py [DIR]
+#
+# The traces are raw IP6 (LINKTYPE_RAW) pcap files, made from a fixed random
+# seed, so every run writes the same bytes. Upper layer checksums are valid.
+#
+#   plain.pcap      1000 packets, TCP, UDP and ICMPv6 with no extension header
+#   ext-mix.pcap    1000 packets, mostly as plain.pcap, with fragments,
+#                   hop-by-hop Router Alert (MLD), destination options,
+#                   routing headers (types 0 and 4) and ESP in the
+#                   proportions of a campus border
+#   ext-heavy.pcap  500 packets with long extension header chains, routing
+#                   headers of 1 to 23 addresses and unknown options
+
+import random
+import struct
+import sys
+import os
+
+PROTO_HBH, PROTO_TCP, PROTO_UDP, PROTO_RH, PROTO_FRAG = 0, 6, 17, 43, 44
+PROTO_ESP, PROTO_ICMP, PROTO_NONE, PROTO_DEST = 50, 58, 59, 60
+
+def addr(s):
+    import ipaddress
+    return ipaddress.IPv6Address(s).packed
+
+def cksum(data):
+    if len(data) % 2:
+        data += b'\0'
+    s = sum(struct.unpack('!%dH' % (len(data) // 2), data))
+    while s >> 16:
+        s = (s & 0xFFFF) + (s >> 16)
+    return ~s & 0xFFFF
+
+def upper(proto, src, dst, hdr, payload, cksum_at):
+    seg = bytearray(hdr + payload)
+    pseudo = src + dst + struct.pack('!IxxxB', len(seg), proto)
+    struct.pack_into('!H', seg, cksum_at, cksum(pseudo + bytes(seg)))
+    return bytes(seg)
+
+def tcp(src, dst, sport, dport, flags, payload):
+    hdr = struct.pack('!HHIIBBHHH', sport, dport, random.getrandbits(32),
+                      random.getrandbits(32), 5 << 4, flags, 65535, 0, 0)
+    return upper(PROTO_TCP, src, dst, hdr, payload, 16)
+
+def udp(src, dst, sport, dport, payload):
+    hdr = struct.pack('!HHHH', sport, dport, 8 + len(payload), 0)
+    return upper(PROTO_UDP, src, dst, hdr, payload, 6)
+
+def icmp(src, dst, type, code, body):
+    return upper(PROTO_ICMP, src, dst, struct.pack('!BBH', type, code, 0), body, 2)
+
+def ext(nxt, body):
+    # body excludes Next Header and length; padded to 8 bytes with PadN
+    body = bytes(body)
+    pad = (-(len(body) + 2)) % 8
+    if pad == 1:
+        body += b'\0'
+    elif pad:
+        body += bytes([1, pad - 2]) + b'\0' * (pad - 2)
+    return bytes([nxt, (len(body) + 2) // 8 - 1]) + body
+
+def options(nxt, opts=b''):
+    return ext(nxt, opts)
+
+def rh(nxt, type, segleft, addrs):
+    return bytes([nxt, 2 * len(addrs), type, segleft]) + b'\0' * 4 + b''.join(addrs)
+
+def frag(nxt, offset, more, ident):
+    return struct.pack('!BBHI', nxt, 0, (offset << 3) | more, ident)
+
+def ip6(src, dst, chain, hlim=64):
+    """chain is a list of (Next Header value, bytes), in order"""
+    data = b''.join(h for _, h in chain)
+    return struct.pack('!IHBB', 0x60000000 | random.getrandbits(20), len(data),
+                       chain[0][0], hlim) + src + dst + data
+
+def payload(n):
+    return bytes(random.getrandbits(8) for _ in range(n))
+
+def host(net, n):
+    return addr('%s%x' % (net, n))
+
+CLIENTS = '2001:db8:1::'
+SERVERS = '2001:db8:2::'
+
+def flow():
+    return (host(CLIENTS, random.randint(1, 500)), host(SERVERS, random.randint(1, 20)),
+            random.randint(32768, 60999))
+
+def plain_packet():
+    src, dst, sport = flow()
+    r = random.random()
+    if r < 0.40:        # ACK
+        return ip6(src, dst, [(PROTO_TCP, tcp(src, dst, sport, 443, 0x10, b''))])
+    if r < 0.70:        # full sized data, server to client
+        return ip6(dst, src, [(PROTO_TCP, tcp(dst, src, 443, sport, 0x18, payload(1440)))])
+    if r < 0.78:        # small data
+        return ip6(src, dst, [(PROTO_TCP, tcp(src, dst, sport, random.choice((80, 443, 22)),
+                                               0x18, payload(random.randint(20, 600))))])
+    if r < 0.80:        # SYN
+        return ip6(src, dst, [(PROTO_TCP, tcp(src, dst, sport, 443, 0x02, b''))])
+    if r < 0.90:        # DNS
+        return ip6(src, dst, [(PROTO_UDP, udp(src, dst, sport, 53, payload(random.randint(30, 120))))])
+    if r < 0.97:        # QUIC
+        return ip6(src, dst, [(PROTO_UDP, udp(src, dst, sport, 443, payload(1232)))])
+    return ip6(src, dst, [(PROTO_ICMP, icmp(src, dst, 128, 0, payload(56)))])
+
+def fragmented_udp(src, dst, sport, dport, data, chunk=1232):
+    """The fragments of a UDP datagram, as from a 1280-byte path"""
+    seg = udp(src, dst, sport, dport, data)
+    ident = random.getrandbits(32)
+    out = []
+    for off in range(0, len(seg), chunk):
+        more = 1 if off + chunk < len(seg) else 0
+        out.append(ip6(src, dst, [(PROTO_FRAG, frag(PROTO_UDP, off // 8, more, ident)),
+                                  (PROTO_UDP, seg[off:off + chunk])]))
+    return out
+
+def mld_report(src):
+    # MLDv2 report of one group, with Router Alert
+    dst = addr('ff02::16')
+    body = struct.pack('!HH', 0, 1) + struct.pack('!BBH', 4, 0, 0) + addr('ff0e::1:3')
+    return ip6(src, dst, [(PROTO_HBH, options(PROTO_ICMP, bytes([5, 2, 0, 0]))),
+                          (PROTO_ICMP, icmp(src, dst, 143, 0, body))], hlim=1)
+
+def mix_packets():
+    r = random.random()
+    if r < 0.84:
+        return [plain_packet()]
+    src, dst, sport = flow()
+    if r < 0.89:        # EDNS answer fragmented on the way
+        return fragmented_udp(dst, src, 53, sport, payload(random.randint(1400, 3800)))
+    if r < 0.92:
+        return [mld_report(src)]
+    if r < 0.94:        # destination options
+        return [ip6(src, dst, [(PROTO_DEST, options(PROTO_TCP)),
+                               (PROTO_TCP, tcp(src, dst, sport, 443, 0x18, payload(200)))])]
+    if r < 0.97:        # ESP tunnel traffic
+        return [ip6(src, dst, [(PROTO_ESP, struct.pack('!II', 0x1000, random.getrandbits(31))
+                                + payload(random.choice((120, 1400))))])]
+    segs = [host(SERVERS, random.randint(0x100, 0x1ff)) for _ in range(random.randint(1, 3))]
+    if r < 0.99:        # segment routing header
+        return [ip6(src, segs[-1], [(PROTO_RH, rh(PROTO_TCP, 4, len(segs) - 1, segs)),
+                                    (PROTO_TCP, tcp(src, dst, sport, 443, 0x18, payload(500)))])]
+    # type 0 routing header, deprecated but still seen
+    return [ip6(src, segs[0], [(PROTO_RH, rh(PROTO_UDP, 0, len(segs), segs[1:] + [dst])),
+                               (PROTO_UDP, udp(src, dst, sport, 53, payload(40)))])]
+
+def heavy_packets():
+    src, dst, sport = flow()
+    n = random.choice((1, 2, 4, 8, 16, 23))
+    segs = [host(SERVERS, 0x100 + i) for i in range(n)]
+    hbh = random.choice((
+        b'',                            # PadN only
+        bytes([5, 2, 0, 0]),            # Router Alert
+        bytes([0x1e, 2, 0, 0]),         # unknown, skip
+        bytes([0x9e, 2, 0, 0]),         # unknown, discard
+    ))
+    chain = [(PROTO_HBH, options(PROTO_DEST, hbh)),
+             (PROTO_DEST, options(PROTO_RH, bytes([1, 12]) + b'\0' * 12))]
+    if random.random() < 0.5:
+        seg = tcp(src, dst, sport, 443, 0x18, payload(random.randint(0, 1000)))
+        chain += [(PROTO_RH, rh(PROTO_FRAG, 0, n, segs[1:] + [dst])),
+                  (PROTO_FRAG, frag(PROTO_TCP, 0, 0, random.getrandbits(32))),
+                  (PROTO_TCP, seg)]
+    else:
+        seg = udp(src, dst, sport, 4500, payload(random.randint(0, 1000)))
+        chain += [(PROTO_RH, rh(PROTO_UDP, 0, n, segs[1:] + [dst])), (PROTO_UDP, seg)]
+    return [ip6(src, segs[0], chain)]
+
+def write(path, make, count):
+    with open(path, 'wb') as f:
+        f.write(struct.pack('<IHHiIII', 0xa1b2c3d4, 2, 4, 0, 0, 65535, 101))
+        usec = 0
+        n = 0
+        while n < count:
+            for p in make():
+                usec += random.randint(1, 20)
+                f.write(struct.pack('<IIII', 1700000000 + usec // 1000000, usec % 1000000,
+                                    len(p), len(p)))
+                f.write(p)
+                n += 1
+
+def main():
+    out = sys.argv[1] if len(sys.argv) > 1 else os.path.dirname(os.path.abspath(__file__))
+    random.seed(6)
+    write(os.path.join(out, 'plain.pcap'), lambda: [plain_packet()], 1000)
+    write(os.path.join(out, 'ext-mix.pcap'), mix_packets, 1000)
+    write(os.path.join(out, 'ext-heavy.pcap'), heavy_packets, 500)
+
+if __name__ == '__main__':
+    main()